@@ -16,8 +16,15 @@
     along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "blur.h"
-#include <cmath>
+#include "parallel.h"
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 
 
@@ -52,93 +59,531 @@ Boxes computeGaussBoxes(double sigma)
 
 
 
-void blurHorz(QImage& tgt, QImage& src, Boxes boxes)
+/// One sliding window step for a row of \a n independent box filters: adds
+/// the \a add pixels to the accumulators \a acc, subtracts the \a sub pixels,
+/// and writes the averages to \a out. Instead of dividing by the diameter of
+/// the box, the accumulators are multiplied with its fixed-point reciprocal
+/// \a mul and shifted, which gives the same result as long as the diameter
+/// does not exceed MaxReciprocalDia.
+using BoxKernel = void (*)(uchar* out, uint* acc, const uchar* add, const uchar* sub, uint n, uint32_t mul);
+
+/// The largest box diameter for which the reciprocal multiplication in the
+/// kernels is exact for all sums of 8 bit pixels (tested up to 4177).
+constexpr uint MaxReciprocalDia = 4096;
+
+
+
+inline uint32_t reciprocal(uint dia) noexcept
+{ return static_cast<uint32_t>((uint64_t{1} << 32u) / dia + 1); }
+
+
+inline uchar scaled(uint acc, uint32_t mul) noexcept
+{ return static_cast<uchar>((uint64_t{acc} * mul) >> 32u); }
+
+
+
+void boxKernelScalar(uchar* out, uint* acc, const uchar* add, const uchar* sub, uint n, uint32_t mul)
 {
-  uint width  = static_cast<uint>(src.width());
-  int  height = src.height();
+  for (uint x = 0; x < n; ++x)
+    out[x] = scaled(acc[x] += add[x] - sub[x], mul);
+}
+
 
-  for (int y = 0; y < height; ++y)
+
+#if defined(__SSE2__)
+/// The high 32 bits of the products of the four lanes of \a acc with \a mul.
+inline __m128i mulHigh(__m128i acc, __m128i mul) noexcept
+{
+  auto even = _mm_srli_epi64(_mm_mul_epu32(acc, mul), 32);
+  auto odd  = _mm_mul_epu32(_mm_srli_epi64(acc, 32), mul);
+  return _mm_or_si128(even, _mm_and_si128(odd, _mm_set_epi32(-1, 0, -1, 0)));
+}
+
+
+
+/// Processes 16 pixels per iteration, in four vectors of 32 bit lanes.
+void boxKernelSse2(uchar* out, uint* acc, const uchar* add, const uchar* sub, uint n, uint32_t mul)
+{
+  auto m    = _mm_set1_epi32(static_cast<int>(mul));
+  auto zero = _mm_setzero_si128();
+
+  uint x = 0;
+  for (; x + 16 <= n; x += 16)
   {
-    auto s = src.scanLine(y);
-    auto t = tgt.scanLine(y);
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + x));
+    auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sub + x));
+
+    __m128i a16[2] = { _mm_unpacklo_epi8(a, zero), _mm_unpackhi_epi8(a, zero) };
+    __m128i s16[2] = { _mm_unpacklo_epi8(s, zero), _mm_unpackhi_epi8(s, zero) };
+    __m128i q[4];
 
-    for (auto r: boxes)
+    for (int i = 0; i < 4; ++i)
     {
-      auto first = s[0];
-      auto last  = s[width-1];
-      uint acc   = first * (r + 1);
+      auto ai = (i & 1 ? _mm_unpackhi_epi16(a16[i/2], zero) : _mm_unpacklo_epi16(a16[i/2], zero));
+      auto si = (i & 1 ? _mm_unpackhi_epi16(s16[i/2], zero) : _mm_unpacklo_epi16(s16[i/2], zero));
+      auto p  = reinterpret_cast<__m128i*>(acc + x + 4*i);
+      auto ac = _mm_add_epi32(_mm_loadu_si128(p), _mm_sub_epi32(ai, si));
+      _mm_storeu_si128(p, ac);
+      q[i] = mulHigh(ac, m);
+    }
+
+    auto packed = _mm_packus_epi16(_mm_packs_epi32(q[0], q[1]), _mm_packs_epi32(q[2], q[3]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), packed);
+  }
+
+  boxKernelScalar(out + x, acc + x, add + x, sub + x, n - x, mul);
+}
+#endif
+
 
-      for (uint x = 0; x < r; ++x)
-        acc += s[x];
 
-      auto tx  = t;
-      auto sx  = s - r - 1;
-      uint dia = 2*r + 1;
+#if defined(__SSE2__) && defined(__GNUC__)
+#define DRAWSCII_AVX2
+/// Processes 32 pixels per iteration, in four vectors of 32 bit lanes.
+__attribute__((target("avx2")))
+void boxKernelAvx2(uchar* out, uint* acc, const uchar* add, const uchar* sub, uint n, uint32_t mul)
+{
+  auto m   = _mm256_set1_epi32(static_cast<int>(mul));
+  auto odd = _mm256_set_epi32(-1, 0, -1, 0, -1, 0, -1, 0);
 
-      for (; tx <= t + r;        ++tx, ++sx) *tx = static_cast<uchar>((acc += sx[dia] - first) / dia);
-      for (; tx < t + width - r; ++tx, ++sx) *tx = static_cast<uchar>((acc += sx[dia] - *sx) / dia);
-      for (; tx < t + width;     ++tx, ++sx) *tx = static_cast<uchar>((acc += last    - *sx) / dia);
+  uint x = 0;
+  for (; x + 32 <= n; x += 32)
+  {
+    __m256i q[4];
 
-      std::swap(s, t);
+    for (int i = 0; i < 4; ++i)
+    {
+      auto ai = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(add + x + 8*i)));
+      auto si = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(sub + x + 8*i)));
+      auto p  = reinterpret_cast<__m256i*>(acc + x + 8*i);
+      auto ac = _mm256_add_epi32(_mm256_loadu_si256(p), _mm256_sub_epi32(ai, si));
+      _mm256_storeu_si256(p, ac);
+
+      auto even = _mm256_srli_epi64(_mm256_mul_epu32(ac, m), 32);
+      auto high = _mm256_mul_epu32(_mm256_srli_epi64(ac, 32), m);
+      q[i] = _mm256_or_si256(even, _mm256_and_si256(high, odd));
     }
+
+    // The packs work within 128 bit halves, so the groups of four pixels end
+    // up in the order 0 2 4 6 1 3 5 7 and have to be permuted back.
+    auto packed = _mm256_packus_epi16(_mm256_packs_epi32(q[0], q[1]), _mm256_packs_epi32(q[2], q[3]));
+    packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), packed);
   }
+
+  boxKernelSse2(out + x, acc + x, add + x, sub + x, n - x, mul);
 }
+#endif
 
 
 
-void blurVert(QImage& tgt, QImage& src, Boxes boxes)
+/// The function of \a kernel, or nullptr if the CPU does not support it.
+BoxKernel boxKernel(BlurKernel kernel)
 {
-  int  width  = src.width();
+  switch (kernel)
+  {
+    case BlurKernel::Scalar:
+      return boxKernelScalar;
+
+    case BlurKernel::Sse2:
+#if defined(__SSE2__)
+      return boxKernelSse2;
+#else
+      return nullptr;
+#endif
+
+    case BlurKernel::Avx2:
+#if defined(DRAWSCII_AVX2)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2"))
+        return boxKernelAvx2;
+#endif
+      return nullptr;
+  }
+
+  return nullptr;
+}
+
+
+
+/// The fastest kernel the CPU supports.
+BoxKernel fastestBoxKernel()
+{
+  for (auto kernel: {BlurKernel::Avx2, BlurKernel::Sse2})
+    if (auto fn = boxKernel(kernel))
+      return fn;
+
+  return boxKernelScalar;
+}
+
+
+
+/// The number of columns blurStrip() processes at once. Their accumulators
+/// stay in the L1 cache, while each row of the strip is read sequentially.
+constexpr uint StripWidth = 512;
+
+/// The number of rows blurHorz() transposes into a strip at once.
+constexpr uint BandHeight = 32;
+
+
+
+/// Blurs the columns of the \a width x \a height pixels at \a s, which are
+/// \a bpl bytes apart, with the \a boxes, using \a kernel where it is exact.
+/// \a t is used as a buffer of the same layout. For an odd number of boxes,
+/// the result ends up in \a t.
+void blurStrip(uchar* t, uchar* s, uint bpl, uint width, uint height, Boxes boxes, BoxKernel kernel)
+{
+  uint acc[StripWidth];
+
+  for (auto r: boxes)
+  {
+    auto first = s;
+    auto last  = s + bpl*(height-1);
+    uint dia   = 2*r + 1;
+    auto step  = (dia <= MaxReciprocalDia ? kernel : nullptr);
+    auto mul   = reciprocal(dia);
+
+    for (uint x = 0; x < width; ++x)
+      acc[x] = first[x] * (r + 1);
+
+    for (uint y = 0; y < r; ++y)
+      for (uint x = 0; x < width; ++x)
+        acc[x] += s[y*bpl + x];
+
+    for (uint y = 0; y < height; ++y)
+    {
+      auto add = (y + r < height ? s + (y + r) * bpl : last);
+      auto sub = (y > r ? s + (y - r - 1) * bpl : first);
+      auto ty  = t + y * bpl;
+
+      if (step)
+        step(ty, acc, add, sub, width, mul);
+      else
+        for (uint x = 0; x < width; ++x)
+          ty[x] = static_cast<uchar>((acc[x] += add[x] - sub[x]) / dia);
+    }
+
+    std::swap(s, t);
+  }
+}
+
+
+
+/// The size of a cache line. Partitions that are processed by different
+/// threads are aligned to it, so that no cache line is written by two
+/// threads.
+constexpr uint CacheLine = 64;
+
+/// Images with less pixels are blurred by a single thread.
+constexpr uint MinParallelPixels = 512 * 512;
+
+
+
+/// The number of partitions to split \a units of work of an image with \a
+/// pixels into, so that all threads are busy even if some finish early.
+/// \a forced overrides that, if not 0.
+int partitions(uint units, uint pixels, int forced = 0)
+{
+  if (forced)
+    return static_cast<int>(std::min(units, static_cast<uint>(forced)));
+
+  if (pixels < MinParallelPixels)
+    return 1;
+
+  return static_cast<int>(std::min(units, static_cast<uint>(parallelism()) * 2));
+}
+
+
+
+/// Blurs the rows of the image. Bands of BandHeight rows are transposed into
+/// a buffer, so that the rows become the columns of a strip, which is then
+/// blurred by the same vectorized code as in blurVert(). The bands are
+/// distributed over all threads.
+void blurHorz(QImage& tgt, QImage& src, Boxes boxes, BoxKernel kernel, int forcedParts)
+{
+  uint width  = static_cast<uint>(src.width());
   uint height = static_cast<uint>(src.height());
+  uint bands  = (height + BandHeight - 1) / BandHeight;
+  int  parts  = partitions(bands, width * height, forcedParts);
 
-  auto s0  = src.bits();
+  auto s0  = src.constBits();
   auto t0  = tgt.bits();
   auto bpl = static_cast<uint>(src.bytesPerLine());
   assert(static_cast<int>(bpl) == tgt.bytesPerLine());
 
-  for (int x = 0; x < width; ++x)
+  parallelFor(parts, [&](int i)
   {
-    auto s = s0 + x;
-    auto t = t0 + x;
+    std::vector<uchar> band(width * BandHeight);
+    std::vector<uchar> buffer(width * BandHeight);
+
+    auto begin = bands * static_cast<uint>(i) / static_cast<uint>(parts);
+    auto end   = bands * static_cast<uint>(i + 1) / static_cast<uint>(parts);
 
-    for (auto r: boxes)
+    for (uint y0 = begin * BandHeight; y0 < std::min(end * BandHeight, height); y0 += BandHeight)
     {
-      auto first = s[0];
-      auto last  = s[bpl*(height-1)];
-      uint acc   = first * (r + 1);
+      uint rows = std::min(BandHeight, height - y0);
+
+      for (uint x0 = 0; x0 < width; x0 += BandHeight)
+        for (uint y = 0; y < rows; ++y)
+        {
+          auto sy = s0 + (y0 + y) * bpl;
+          for (uint x = x0; x < std::min(x0 + BandHeight, width); ++x)
+            band[x*BandHeight + y] = sy[x];
+        }
+
+      blurStrip(buffer.data(), band.data(), BandHeight, rows, width, boxes, kernel);
+      static_assert(std::tuple_size<Boxes>::value % 2 == 1, "result must end up in buffer");
+
+      for (uint x0 = 0; x0 < width; x0 += BandHeight)
+        for (uint y = 0; y < rows; ++y)
+        {
+          auto ty = t0 + (y0 + y) * bpl;
+          for (uint x = x0; x < std::min(x0 + BandHeight, width); ++x)
+            ty[x] = buffer[x*BandHeight + y];
+        }
+    }
+  });
+}
+
+
+
+/// Same as blurHorz(), but for the columns of the image. The image is walked
+/// row by row in strips of StripWidth columns, rather than column by column,
+/// to avoid a cache miss for every pixel. The columns are distributed over
+/// all threads in multiples of a cache line.
+void blurVert(QImage& tgt, QImage& src, Boxes boxes, BoxKernel kernel, int forcedParts)
+{
+  uint width  = static_cast<uint>(src.width());
+  uint height = static_cast<uint>(src.height());
+
+  auto s0  = src.bits();
+  auto t0  = tgt.bits();
+  auto bpl = static_cast<uint>(src.bytesPerLine());
+  assert(static_cast<int>(bpl) == tgt.bytesPerLine());
+
+  uint lines = (width + CacheLine - 1) / CacheLine;
+  int  parts = partitions(lines, width * height, forcedParts);
 
-      for (uint y = 0; y < r; ++y)
-        acc += s[y*bpl];
+  parallelFor(parts, [&](int i)
+  {
+    auto begin = CacheLine * (lines * static_cast<uint>(i) / static_cast<uint>(parts));
+    auto end   = std::min(CacheLine * (lines * static_cast<uint>(i + 1) / static_cast<uint>(parts)), width);
+
+    for (uint x = begin; x < end; x += StripWidth)
+      blurStrip(t0 + x, s0 + x, bpl, std::min(StripWidth, end - x), height, boxes, kernel);
+  });
+}
+
+
+
+/// Blurs \a img with three passes of box blurs of radius \a r, using \a
+/// kernel where it is exact, and \a forcedParts partitions if not 0.
+void blurBoxes(QImage& img, int r, BoxKernel kernel, int forcedParts)
+{
+  auto boxes = computeGaussBoxes(r / 2.57);
+  static_assert(boxes.size() % 2 == 1, "number of Gauss boxes must be odd"); // see below
+
+  QImage tmp{img.size(), img.format()};
+  blurHorz(tmp, img, boxes, kernel, forcedParts); // odd number of boxes -> result in tmp
+  blurVert(img, tmp, boxes, kernel, forcedParts); // odd number of boxes -> result in img
+}
+} // namespace
 
-      auto ty   = t;
-      auto sy   = s - bpl*(r+1);
-      uint dia  = 2*r + 1;
-      uint diaB = bpl * dia;
-      uint rB   = bpl * r;
-      uint htB  = bpl * height;
 
-      for (; ty <= t + rB;      ty+=bpl, sy+=bpl) *ty = static_cast<uchar>((acc += sy[diaB] - first) / dia);
-      for (; ty < t + htB - rB; ty+=bpl, sy+=bpl) *ty = static_cast<uchar>((acc += sy[diaB] - *sy) / dia);
-      for (; ty < t + htB;      ty+=bpl, sy+=bpl) *ty = static_cast<uchar>((acc += last     - *sy) / dia);
 
-      std::swap(s, t);
+// The recursive Gaussian filter follows
+// I.T. Young, L.J. van Vliet: Recursive implementation of the Gaussian filter.
+// Signal Processing 44 (1995), pp. 139-151.
+//
+namespace {
+
+/// The coefficients of the recursive filter y[n] = b x[n] + a1 y[n-1] +
+/// a2 y[n-2] + a3 y[n-3], which is run forward and then backward.
+struct Recursive
+{
+  explicit Recursive(double sigma) noexcept;
+
+  float b;
+  float a1;
+  float a2;
+  float a3;
+};
+
+
+
+Recursive::Recursive(double sigma) noexcept
+{
+  sigma = std::max(sigma, 0.5);
+
+  double q = (sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma));
+  double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+  double b1 = 2.44413*q + 2.85619*q*q + 1.26661*q*q*q;
+  double b2 = -(1.4281*q*q + 1.26661*q*q*q);
+  double b3 = 0.422205*q*q*q;
+
+  a1 = static_cast<float>(b1 / b0);
+  a2 = static_cast<float>(b2 / b0);
+  a3 = static_cast<float>(b3 / b0);
+  b  = 1 - (a1 + a2 + a3);
+}
+
+
+
+/// Filters the \a n values at \a p forward and backward. The values beyond
+/// the ends are assumed to repeat the first and last value.
+void recursiveRow(float* p, uint n, const Recursive& c) noexcept
+{
+  float y1 = p[0], y2 = y1, y3 = y1;
+  for (uint i = 0; i < n; ++i)
+  {
+    float y = c.b*p[i] + c.a1*y1 + c.a2*y2 + c.a3*y3;
+    p[i] = y; y3 = y2; y2 = y1; y1 = y;
+  }
+
+  y1 = y2 = y3 = p[n-1];
+  for (uint i = n; i-- > 0;)
+  {
+    float y = c.b*p[i] + c.a1*y1 + c.a2*y2 + c.a3*y3;
+    p[i] = y; y3 = y2; y2 = y1; y1 = y;
+  }
+}
+
+
+
+/// Filters the columns [\a x0, \a x1) of the \a height rows at \a p, which
+/// are \a stride values apart, forward and backward. Like in blurStrip(), the
+/// rows are walked one after the other.
+void recursiveColumns(float* p, uint stride, uint x0, uint x1, uint height, const Recursive& c)
+{
+  std::vector<float> edge(p + x0, p + x1);
+  auto row = [&](uint y) { return p + y*stride + x0; };
+  uint n   = x1 - x0;
+
+  for (uint y = 0; y < height; ++y)
+  {
+    auto r0 = row(y);
+    auto r1 = (y >= 1 ? row(y-1) : edge.data());
+    auto r2 = (y >= 2 ? row(y-2) : edge.data());
+    auto r3 = (y >= 3 ? row(y-3) : edge.data());
+
+    for (uint x = 0; x < n; ++x)
+      r0[x] = c.b*r0[x] + c.a1*r1[x] + c.a2*r2[x] + c.a3*r3[x];
+  }
+
+  edge.assign(row(height-1), row(height-1) + n);
+  for (uint y = height; y-- > 0;)
+  {
+    auto r0 = row(y);
+    auto r1 = (y + 1 < height ? row(y+1) : edge.data());
+    auto r2 = (y + 2 < height ? row(y+2) : edge.data());
+    auto r3 = (y + 3 < height ? row(y+3) : edge.data());
+
+    for (uint x = 0; x < n; ++x)
+      r0[x] = c.b*r0[x] + c.a1*r1[x] + c.a2*r2[x] + c.a3*r3[x];
+  }
+}
+
+
+
+/// The standard deviation of the blur by the boxes for radius \a r. Since
+/// the box passes use the computed box sizes as radius, it is considerably
+/// larger than r / 2.57. The recursive filter uses it to look the same.
+double boxesSigma(int r)
+{
+  double variance = 0;
+  for (auto box: computeGaussBoxes(r / 2.57))
+    variance += ((2*box + 1) * (2*box + 1) - 1) / 12.0;
+
+  return sqrt(variance);
+}
+
+
+
+/// Blurs \a img with the recursive filter. Its cost per pixel does not
+/// depend on \a sigma.
+void blurRecursive(QImage& img, double sigma)
+{
+  uint width  = static_cast<uint>(img.width());
+  uint height = static_cast<uint>(img.height());
+  Recursive coeffs{sigma};
+
+  std::vector<float> buffer(width * height);
+  auto bits = buffer.data();
+  auto rows = partitions(height, width * height);
+
+  parallelFor(rows, [&](int i)
+  {
+    auto begin = height * static_cast<uint>(i) / static_cast<uint>(rows);
+    auto end   = height * static_cast<uint>(i + 1) / static_cast<uint>(rows);
+
+    for (uint y = begin; y < end; ++y)
+    {
+      std::copy_n(img.constScanLine(static_cast<int>(y)), width, bits + y*width);
+      recursiveRow(bits + y*width, width, coeffs);
     }
+  });
+
+  uint lines   = (width + CacheLine - 1) / CacheLine;
+  auto columns = partitions(lines, width * height);
+
+  parallelFor(columns, [&](int i)
+  {
+    auto begin = CacheLine * (lines * static_cast<uint>(i) / static_cast<uint>(columns));
+    auto end   = std::min(CacheLine * (lines * static_cast<uint>(i + 1) / static_cast<uint>(columns)), width);
+
+    if (begin < end)
+      recursiveColumns(bits, width, begin, end, height, coeffs);
+  });
+
+  for (uint y = 0; y < height; ++y)
+  {
+    auto ty = img.scanLine(static_cast<int>(y));
+    auto sy = bits + y*width;
+
+    for (uint x = 0; x < width; ++x)
+      ty[x] = static_cast<uchar>(qBound(0, qRound(sy[x]), 255));
   }
 }
 } // namespace
 
 
 
-void blurImage(QImage& img, int r)
+void blurImage(QImage& img, int r, BlurMethod method)
 {
   assert(img.format() == QImage::Format_Alpha8);
 
-  auto boxes = computeGaussBoxes(r / 2.57);
-  static_assert(boxes.size() % 2 == 1, "number of Gauss boxes must be odd"); // see below
+  if (method == BlurMethod::Recursive)
+  { blurRecursive(img, boxesSigma(r)); return; }
 
-  QImage tmp{img.size(), img.format()};
-  blurHorz(tmp, img, boxes); // odd number of boxes -> result in tmp
-  blurVert(img, tmp, boxes); // odd number of boxes -> result in img
+  static const BoxKernel fastKernel = fastestBoxKernel();
+  blurBoxes(img, r, fastKernel, 0);
+}
+
+
+
+void blurImage(QImage& img, int r, BlurKernel kernel, int parts)
+{
+  assert(img.format() == QImage::Format_Alpha8);
+  assert(isSupported(kernel));
+
+  blurBoxes(img, r, boxKernel(kernel), parts);
+}
+
+
+
+bool isSupported(BlurKernel kernel)
+{ return boxKernel(kernel) != nullptr; }
+
+
+
+int blurExtent(int r, BlurMethod method)
+{
+  // The tail of the recursive filter beyond five sigma rounds to zero
+  if (method == BlurMethod::Recursive)
+    return static_cast<int>(ceil(5 * boxesSigma(r)));
+
+  auto boxes = computeGaussBoxes(r / 2.57);
+  return static_cast<int>(std::accumulate(boxes.begin(), boxes.end(), 0u));
 }
 
 
@@ -162,3 +607,77 @@ QImage filledImage(QColor color, const QImage& alpha)
 
   return result;
 }
+
+
+
+namespace {
+/// Multiplies the four 8 bit channels of \a x with \a a / 255, rounding the
+/// same way as Qt's raster engine does.
+inline uint32_t byteMul(uint32_t x, uint a) noexcept
+{
+  uint32_t t = (x & 0xff00ffu) * a;
+  t = ((t + ((t >> 8u) & 0xff00ffu) + 0x800080u) >> 8u) & 0xff00ffu;
+
+  x = ((x >> 8u) & 0xff00ffu) * a;
+  x = (x + ((x >> 8u) & 0xff00ffu) + 0x800080u) & 0xff00ff00u;
+
+  return x | t;
+}
+} // namespace
+
+
+
+void blendMask(QImage& target, QPoint pos, QColor color, const QImage& alpha)
+{
+  assert(alpha.format() == QImage::Format_Alpha8);
+
+  auto area = target.rect() & QRect{pos, alpha.size()};
+  if (area.isEmpty())
+    return;
+
+  // The premultiplied source pixel for each alpha value
+  QRgb rgb = color.rgb() & 0x00ffffffu;
+  uint32_t source[256];
+  for (uint a = 0; a < 256; ++a)
+    source[a] = qPremultiply(rgb | (a << 24u));
+
+  if (target.format() == QImage::Format_Grayscale8)
+  {
+    // All channels are equal, so blue stands for all of them
+    assert(qRed(rgb) == qBlue(rgb) && qGreen(rgb) == qBlue(rgb));
+
+    for (int y = area.top(); y <= area.bottom(); ++y)
+    {
+      auto ty = target.scanLine(y) + area.left();
+      auto ay = alpha.constScanLine(y - pos.y()) + (area.left() - pos.x());
+
+      for (int x = 0; x < area.width(); ++x)
+      {
+        uint a = ay[x];
+        if (a == 255)
+          ty[x] = static_cast<uchar>(source[a]);
+        else if (a)
+          ty[x] = static_cast<uchar>(source[a] + byteMul(ty[x], 255 - a));
+      }
+    }
+
+    return;
+  }
+
+  assert(target.format() == QImage::Format_RGB32 || target.format() == QImage::Format_ARGB32_Premultiplied);
+
+  for (int y = area.top(); y <= area.bottom(); ++y)
+  {
+    auto ty = reinterpret_cast<uint32_t*>(target.scanLine(y)) + area.left();
+    auto ay = alpha.constScanLine(y - pos.y()) + (area.left() - pos.x());
+
+    for (int x = 0; x < area.width(); ++x)
+    {
+      uint a = ay[x];
+      if (a == 255)
+        ty[x] = source[a];
+      else if (a)
+        ty[x] = source[a] + byteMul(ty[x], 255 - a);
+    }
+  }
+}
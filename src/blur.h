@@ -21,9 +21,42 @@
 
 
 
+/// How blurImage() approximates a Gaussian blur: with three passes of box
+/// blurs, or with a recursive filter whose cost does not depend on the radius.
+enum class BlurMethod
+{ Boxes, Recursive };
+
+
+
+/// The implementations of the sliding window step of the box blur.
+/// blurImage() uses the fastest one the CPU supports.
+enum class BlurKernel
+{ Scalar, Sse2, Avx2 };
+
+
+
 /// Convolutes \a img with a Gaussian blur of radius \a r.
-void blurImage(QImage& img, int r);
+void blurImage(QImage& img, int r, BlurMethod method = BlurMethod::Boxes);
+
+/// Same as blurImage() with BlurMethod::Boxes, but with the given \a kernel,
+/// and with each pass split into \a parts partitions, if not 0, regardless
+/// of the size of \a img. For testing that all of them give the same result.
+void blurImage(QImage& img, int r, BlurKernel kernel, int parts = 0);
+
+/// Whether \a kernel is compiled in and supported by the CPU.
+bool isSupported(BlurKernel kernel);
+
+/// How many pixels blurImage() with radius \a r spreads a single pixel in
+/// each direction. Beyond that, the result does not depend on the pixel.
+int blurExtent(int r, BlurMethod method = BlurMethod::Boxes);
 
 /// An ARGB32 image where the alpha channel of each pixel is taken from \a
 /// alpha, while red, green, blue are set to \a color.
 QImage filledImage(QColor color, const QImage& alpha);
+
+/// Blends \a color onto \a target with the opacity given by \a alpha, whose
+/// top-left corner is at \a pos. The result is the same as drawing
+/// filledImage() at \a pos with a QPainter, but without allocating it. \a
+/// target must be in RGB32, premultiplied ARGB32 or Grayscale8 format; for
+/// the latter, \a color must be gray.
+void blendMask(QImage& target, QPoint pos, QColor color, const QImage& alpha);
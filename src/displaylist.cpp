@@ -0,0 +1,360 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "displaylist.h"
+#include "blur.h"
+#include <algorithm>
+#include <iterator>
+#include <QFontMetricsF>
+#include <QPaintDevice>
+#include <QPainter>
+
+
+
+inline DisplayList::Command::Command(int k, const QPen& p, const QBrush& b, const QRectF& r)
+  : bounds{r},
+    pen{p},
+    brush{b},
+    flags{0},
+    kind{static_cast<Kind>(k)}
+{}
+
+
+
+/// Whether \a other can be merged into this command, i.e. it draws the same
+/// kind of thing with the same painter state.
+bool DisplayList::Command::mergeableWith(const Command& other) const noexcept
+{
+  if (kind != other.kind || pen != other.pen || brush != other.brush)
+    return false;
+
+  switch (kind)
+  {
+    case Path:
+      return true;
+
+    case Stamps:
+      return path == other.path && rect == other.rect && offset == other.offset && image.cacheKey() == other.image.cacheKey();
+
+    default:
+      return false;
+  }
+}
+
+
+
+/// Whether merging an overlapping command into this one still looks the same.
+/// This is only the case for opaque stamps that are only filled: on bitmaps,
+/// each of them is stamped on its own anyway. Overlapping strokes do not merge,
+/// even opaque ones: where their antialiased edges cross, drawing them one
+/// after the other blends the edges, while a merged path only gets the
+/// coverage of their union.
+bool DisplayList::Command::mergesOverlapping() const noexcept
+{
+  return kind == Stamps
+         && pen.style() == Qt::NoPen
+         && brush.style() != Qt::NoBrush && brush.isOpaque();
+}
+
+
+
+void DisplayList::Command::merge(Command&& other)
+{
+  assert(mergeableWith(other));
+
+  if (kind == Path)
+  {
+    // The merged paths are kept as well, so that replaying a small region
+    // only draws those near it
+    if (parts.empty())
+      parts.push_back(Part{bounds, path});
+
+    path.addPath(other.path);
+    if (other.parts.empty())
+      parts.push_back(Part{other.bounds, std::move(other.path)});
+    else
+      std::move(other.parts.begin(), other.parts.end(), std::back_inserter(parts));
+  }
+  else
+    positions += other.positions;
+
+  bounds |= other.bounds;
+}
+
+
+
+/// The glyph of a Stamps command at all its positions within \a region.
+QPainterPath DisplayList::Command::stampedPath(const QRectF& region) const
+{
+  QPainterPath result;
+  result.setFillRule(Qt::WindingFill);
+
+  auto glyphRect = path.controlPointRect();
+  for (auto& pos: positions)
+    if (region.isNull() || region.intersects(glyphRect.translated(pos)))
+      result.addPath(path.translated(pos));
+
+  return result;
+}
+
+
+
+/// The path of a Path command, reduced to the merged paths within \a region.
+QPainterPath DisplayList::Command::partialPath(const QRectF& region) const
+{
+  if (parts.empty() || region.isNull() || region.contains(bounds))
+    return path;
+
+  QPainterPath result;
+  result.setFillRule(path.fillRule());
+
+  for (auto& part: parts)
+    if (region.intersects(part.bounds))
+      result.addPath(part.path);
+
+  return result;
+}
+
+
+
+namespace {
+/// How far a command may draw beyond the control points of its path.
+inline qreal margin(const QPen& pen) noexcept
+{
+  if (pen.style() == Qt::NoPen)
+    return 1;
+
+  return std::max(pen.widthF(), 1.0) + 2;
+}
+
+/// How many commands optimize() looks back for merging.
+constexpr int MaxLookBack = 64;
+} // namespace
+
+
+
+DisplayList::DisplayList()
+= default;
+
+
+DisplayList::DisplayList(const DisplayList&)
+= default;
+
+
+DisplayList::DisplayList(DisplayList&&) noexcept
+= default;
+
+
+DisplayList& DisplayList::operator=(const DisplayList&)
+= default;
+
+
+DisplayList& DisplayList::operator=(DisplayList&&) noexcept
+= default;
+
+
+DisplayList::~DisplayList()
+= default;
+
+
+
+void DisplayList::setFont(const QFont& font)
+{ mFont = font; }
+
+
+void DisplayList::setPen(const QPen& pen)
+{ mPen = pen; }
+
+
+void DisplayList::setBrush(const QBrush& brush)
+{ mBrush = brush; }
+
+
+
+inline auto DisplayList::append(int kind, const QRectF& bounds) -> Command&
+{
+  mCommands.emplace_back(kind, mPen, mBrush, bounds);
+  return mCommands.back();
+}
+
+
+
+void DisplayList::drawPath(const QPainterPath& path)
+{
+  auto m = margin(mPen);
+  append(Command::Path, path.controlPointRect().adjusted(-m, -m, m, m)).path = path;
+}
+
+
+
+void DisplayList::drawStamps(const QPainterPath& glyph, QVector<QPoint> positions, const QImage& atlas, const QRect& spriteRect, const QPointF& spriteOffset)
+{
+  if (positions.isEmpty())
+    return;
+
+  auto m  = margin(mPen);
+  auto gr = glyph.controlPointRect().adjusted(-m, -m, m, m);
+
+  QRectF bounds;
+  for (auto& pos: positions)
+    bounds |= gr.translated(pos);
+
+  auto& cmd     = append(Command::Stamps, bounds);
+  cmd.path      = glyph;
+  cmd.positions = std::move(positions);
+  cmd.image     = atlas;
+  cmd.rect      = spriteRect;
+  cmd.offset    = spriteOffset;
+}
+
+
+
+void DisplayList::drawMask(const QPoint& pos, const QImage& mask)
+{
+  QRect rect{pos, mask.size()};
+
+  auto& cmd = append(Command::Mask, QRectF{rect}.adjusted(-1, -1, 1, 1));
+  cmd.image = mask;
+  cmd.rect  = rect;
+}
+
+
+
+void DisplayList::drawText(const QRect& rect, int flags, const QString& text)
+{
+  QFontMetricsF fm{mFont};
+  auto bounds = fm.boundingRect(QRectF{rect}, flags, text) | QRectF{rect};
+
+  auto& cmd = append(Command::Text, bounds.adjusted(-1, -1, 1, 1));
+  cmd.rect  = rect;
+  cmd.flags = flags;
+  cmd.text  = text;
+}
+
+
+
+void DisplayList::optimize()
+{
+  std::vector<Command> result;
+  result.reserve(mCommands.size());
+
+  for (auto& cmd: mCommands)
+  {
+    auto target = result.rend();
+    int  ct     = 0;
+
+    for (auto i = result.rbegin(); i != result.rend() && ct < MaxLookBack; ++i, ++ct)
+    {
+      bool overlaps = i->bounds.intersects(cmd.bounds);
+      if (i->mergeableWith(cmd) && (!overlaps || cmd.mergesOverlapping()))
+      { target = i; break; }
+
+      if (overlaps)
+        break;
+    }
+
+    if (target != result.rend())
+      target->merge(std::move(cmd));
+    else
+      result.push_back(std::move(cmd));
+  }
+
+  mCommands = std::move(result);
+}
+
+
+
+void DisplayList::replay(QPainter& painter, const QRectF& region) const
+{
+  bool raster = (painter.device()->devType() == QInternal::Image);
+  painter.setFont(mFont);
+
+  const Command* prev = nullptr;
+  for (auto& cmd: mCommands)
+  {
+    if (!region.isNull() && !region.intersects(cmd.bounds))
+      continue;
+
+    if (!prev || cmd.pen != prev->pen)
+      painter.setPen(cmd.pen);
+
+    if (!prev || cmd.brush != prev->brush)
+      painter.setBrush(cmd.brush);
+
+    prev = &cmd;
+    switch (cmd.kind)
+    {
+      case Command::Path:
+        painter.drawPath(cmd.partialPath(region));
+        break;
+
+      case Command::Stamps:
+        if (raster && !cmd.image.isNull())
+        {
+          QRectF sprite{cmd.offset, QSizeF{cmd.rect.size()}};
+          for (auto& pos: cmd.positions)
+            if (region.isNull() || region.intersects(sprite.translated(pos)))
+              painter.drawImage(QPointF{pos} + cmd.offset, cmd.image, cmd.rect);
+        }
+        else
+          painter.drawPath(cmd.stampedPath(region));
+        break;
+
+      case Command::Mask:
+        replayMask(painter, cmd);
+        break;
+
+      case Command::Text:
+        painter.drawText(cmd.rect, cmd.flags, cmd.text);
+        break;
+    }
+  }
+}
+
+
+
+/// Replays a Mask command. Masks are blended straight into the scanlines of
+/// a QImage, as long as the painter would just draw the pixels at a whole
+/// pixel offset like QPainter::drawImage() does. Otherwise, the mask is
+/// converted to an image of the brush color.
+void DisplayList::replayMask(QPainter& painter, const Command& cmd)
+{
+  auto color = cmd.brush.color();
+  auto dev   = painter.device();
+  auto& m    = painter.transform();
+
+  bool direct = dev->devType() == QInternal::Image
+                && m.type() <= QTransform::TxTranslate
+                && painter.compositionMode() == QPainter::CompositionMode_SourceOver
+                && painter.opacity() == 1.0
+                && !painter.hasClipping();
+
+  if (direct)
+  {
+    auto& img = *static_cast<QImage*>(dev);
+    bool gray = (color.red() == color.green() && color.green() == color.blue());
+    if (img.format() == QImage::Format_RGB32 || img.format() == QImage::Format_ARGB32_Premultiplied
+        || (img.format() == QImage::Format_Grayscale8 && gray))
+    {
+      QPoint pos{qRound(cmd.rect.left() + m.dx()), qRound(cmd.rect.top() + m.dy())};
+      blendMask(img, pos, color, cmd.image);
+      return;
+    }
+  }
+
+  painter.drawImage(cmd.rect.topLeft(), filledImage(color, cmd.image));
+}
@@ -0,0 +1,144 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "common.h"
+#include <vector>
+#include <QBrush>
+#include <QFont>
+#include <QImage>
+#include <QPainterPath>
+#include <QPen>
+#include <QVector>
+class QPainter;
+
+
+
+/// A recorded sequence of drawing commands, each of them together with the
+/// pen and brush it is drawn with. Render records a drawing into a display
+/// list, which can then be optimized and replayed to any number of QPainters.
+///
+/// Replaying a display list only changes the painter state if it differs from
+/// the state of the previous command. optimize() reorders and merges commands
+/// to make that as rare as possible.
+///
+class DisplayList
+{
+  public:
+    /// A recorded drawing command. Only the members of its kind are used.
+    struct Command
+    {
+      enum Kind : quint8 { Path, Stamps, Text, Mask };
+
+      /// One of the paths merged into a Path command.
+      struct Part
+      {
+        QRectF bounds;
+        QPainterPath path;
+      };
+
+      Command(int k, const QPen& p, const QBrush& b, const QRectF& r);
+      bool mergeableWith(const Command& other) const noexcept;
+      bool mergesOverlapping() const noexcept;
+      void merge(Command&& other);
+      QPainterPath stampedPath(const QRectF& region) const;
+      QPainterPath partialPath(const QRectF& region) const;
+
+      QRectF bounds;
+      QPen pen;
+      QBrush brush;
+      QPainterPath path;         // Path; the glyph of Stamps
+      std::vector<Part> parts;   // Path, if merged
+      QVector<QPoint> positions; // Stamps
+      QImage image;              // Mask; the atlas of Stamps
+      QRect rect;                // Mask, Text; the sprite of Stamps
+      QPointF offset;            // Stamps
+      QString text;              // Text
+      int flags;                 // Text
+      Kind kind;
+    };
+
+    using const_iterator = std::vector<Command>::const_iterator;
+
+    DisplayList();
+    DisplayList(const DisplayList&);
+    DisplayList(DisplayList&&) noexcept;
+    DisplayList& operator=(const DisplayList&);
+    DisplayList& operator=(DisplayList&&) noexcept;
+    ~DisplayList();
+
+    /// Sets the font for all text in the display list.
+    void setFont(const QFont& font);
+
+    /// Sets the pen for the commands recorded from now on.
+    void setPen(const QPen& pen);
+
+    /// Sets the brush for the commands recorded from now on.
+    void setBrush(const QBrush& brush);
+
+    /// Records drawing the \a path.
+    void drawPath(const QPainterPath& path);
+
+    /// Records drawing the \a glyph at each of the \a positions. If the
+    /// painter draws onto a QImage when replaying, the glyph is not drawn as a
+    /// path, but the sprite \a spriteRect of the \a atlas is stamped at each
+    /// position plus \a spriteOffset instead.
+    void drawStamps(const QPainterPath& glyph, QVector<QPoint> positions, const QImage& atlas, const QRect& spriteRect, const QPointF& spriteOffset);
+
+    /// Records filling the area of the alpha \a mask, with its top-left
+    /// corner at \a pos, with the color of the current brush. Where
+    /// possible, the color is blended straight into the pixels of the paint
+    /// device when replaying.
+    void drawMask(const QPoint& pos, const QImage& mask);
+
+    /// Records drawing \a text into \a rect, aligned as given by \a flags.
+    void drawText(const QRect& rect, int flags, const QString& text);
+
+    /// Merges commands with identical painter state. A command may be moved
+    /// before earlier commands if it does not overlap with them, so that the
+    /// result looks the same as before.
+    void optimize();
+
+    /// Draws the display list with the \a painter, which must be active. If
+    /// \a region is valid, only the commands intersecting it are drawn. It
+    /// is given in the coordinates of the recorded commands.
+    void replay(QPainter& painter, const QRectF& region = QRectF{}) const;
+
+    /// The number of recorded commands.
+    size_t size() const noexcept
+    { return mCommands.size(); }
+
+    /// The recorded commands, in the order they are replayed.
+    const_iterator begin() const noexcept
+    { return mCommands.begin(); }
+
+    const_iterator end() const noexcept
+    { return mCommands.end(); }
+
+    /// The font for all text in the display list.
+    const QFont& font() const noexcept
+    { return mFont; }
+
+  private:
+    Command& append(int kind, const QRectF& bounds);
+    static void replayMask(QPainter& painter, const Command& cmd);
+
+    std::vector<Command> mCommands;
+    QFont mFont;
+    QPen mPen;
+    QBrush mBrush;
+};
@@ -18,13 +18,21 @@
 #include "graph_construction.h"
 #include "hints.h"
 #include "outputfile.h"
+#include "parallel.h"
+#include "pngwriter.h"
+#include "rawwriter.h"
 #include "render.h"
 #include "runtimeerror.h"
 #include "shapes.h"
+#include "svgwriter.h"
+#include <algorithm>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <numeric>
 #include <sstream>
+#include <utility>
+#include <vector>
 #include <QCommandLineParser>
 #include <QDir>
 #include <QFile>
@@ -33,26 +41,41 @@
 #include <QImage>
 #include <QImageWriter>
 #include <QPdfWriter>
-#include <QSvgGenerator>
+#include <QSet>
 #include <QTextCodec>
 #include <QTextStream>
+#include <QThreadPool>
 
 
 
 enum class Mode { Drawscii, Ditaa };
 
 
+struct Output
+{
+  QString file;
+  QByteArray format;
+  float scale;
+};
+
+
 struct CmdLineArgs
 {
-  QString inputFile;
-  QString outputFile;
+  QStringList inputFiles;
+  std::vector<Output> outputs;
+  std::vector<float> scales{1};
   QTextCodec* codec{nullptr};
   QFont font{"Open Sans"};
   QColor bg{Qt::white};
   float lineWd{1};
   int shadows{0};
+  int shadowSize{DefaultShadowSize};
+  BlurMethod shadowFilter{BlurMethod::Boxes};
+  PngWriter png;
   uint tabWidth{8};
+  int threads{0};
   bool antialias{true};
+  bool grayscale{false};
   bool overwrite{true};
 };
 
@@ -107,6 +130,49 @@ QColor parseColorArg(const QString& value, const char* error)
 
 
 
+PngWriter::Filter parsePngFilterArg(const QString& value, const char* error)
+{
+  static const std::pair<const char*, PngWriter::Filter> filters[] = {
+    {"none",     PngWriter::Filter::None},
+    {"sub",      PngWriter::Filter::Sub},
+    {"up",       PngWriter::Filter::Up},
+    {"average",  PngWriter::Filter::Average},
+    {"paeth",    PngWriter::Filter::Paeth},
+    {"adaptive", PngWriter::Filter::Adaptive},
+  };
+
+  for (auto& filter: filters)
+    if (value == filter.first)
+      return filter.second;
+
+  throw std::runtime_error{error};
+}
+
+
+
+/// Reads the input files listed in the manifest file \a fname, one per line.
+/// Empty lines and lines starting with # are skipped.
+QStringList readManifest(const QString& fname)
+{
+  QFile fd{fname};
+  if (!fd.open(QFile::ReadOnly|QFile::Text))
+    throw RuntimeError{fname, ": ", fd.errorString()};
+
+  auto dir = QFileInfo{fname}.dir();
+  QStringList result;
+  QTextStream is{&fd};
+  while (!is.atEnd())
+  {
+    auto line = is.readLine().trimmed();
+    if (!line.isEmpty() && !line.startsWith('#'))
+      result << QDir::cleanPath(dir.filePath(line));
+  }
+
+  return result;
+}
+
+
+
 CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
 {
   // Drawscii options (some of them will be modified for Ditaa compatibility mode)
@@ -114,12 +180,21 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
   QCommandLineOption backgroundOpt{"background", "Sets the background color for the output image. The following notations are understood: #RGB, #RRGGBB, #AARRGGBB, transparent, and common color names.", "color"};
   QCommandLineOption encodingOpt{{"e", "encoding"}, "Sets the encoding of the input file. Defaults to the encoding selected by the current locale.", "encoding"};
   QCommandLineOption fontOpt{"font", "Sets the font family for the output image.", "font"};
+  QCommandLineOption grayscaleOpt{"grayscale", "Writes PAM and raw files with 8 bit gray pixels; colored drawings are converted to gray. PNG files of drawings without colors are always grayscale."};
+  QCommandLineOption formatOpt{"format", "Sets the format of the output file, instead of determining it from the file extension. Needed for writing to the standard output with -o -.", "format"};
   QCommandLineOption fontSizeOpt{"font-size", "Sets the font size for the output image. Unit is points for PDF output, otherwise pixels.", "size"};
   QCommandLineOption lineWdOpt{"line-width", "Sets the width of lines for the output image. Unit is points for PDF output, otherwise pixels.", "width"};
-  QCommandLineOption outputFileOpt{"o", "Sets the name of the output file to write to. The file type is determined from the file extension.", "path"};
+  QCommandLineOption pngCompressionOpt{"png-compression", "Sets the compression of PNG output: a level from 0 (none) to 9 (best), fast, or max, which tries several filters at level 9 and keeps the smallest result. Defaults to 6.", "level"};
+  QCommandLineOption pngFilterOpt{"png-filter", "Sets the row filter for PNG output: none, sub, up, average, paeth, or adaptive (the default), which chooses one for each row.", "filter"};
+  QCommandLineOption manifestOpt{"manifest", "Reads the names of further input files from the given file, one per line. Empty lines and lines starting with # are skipped, relative names are relative to the directory of the manifest file.", "file"};
+  QCommandLineOption outputFileOpt{"o", "Sets the name of the output file to write to. The file type is determined from the file extension. Can be given several times to write the drawing in several formats at once. %n is replaced by the base name of the input file, and %d by its directory.", "path"};
+  QCommandLineOption scalesOpt{"scales", "Renders the drawing at several scales, given as comma-separated list like 1,2,3. Font size, line width and shadow size are multiplied by each scale. The output file names must then contain %s, which is replaced by the scale.", "scales"};
   QCommandLineOption shadowOpt{"shadows", "Enables drawing drop shadows under closed shapes."};
   QCommandLineOption noShadowOpt{{"S", "no-shadows"}, "Disables drawing drop shadows under closed shapes."};
+  QCommandLineOption shadowFilterOpt{"shadow-filter", "Sets the filter for blurring drop shadows in bitmap output: box (the default), or recursive, which is more accurate for large shadows.", "filter"};
+  QCommandLineOption shadowSizeOpt{"shadow-size", "Sets the offset and blur radius of drop shadows. Unit is pixels, the default is 2.", "size"};
   QCommandLineOption tabsOpt{{"t", "tabs"}, "Sets the tab width for the input file.", "spaces"};
+  QCommandLineOption threadsOpt{"threads", "Sets the number of threads for rendering and batch mode. Defaults to the number of CPU cores.", "count"};
 
   // Ditaa compatibility mode options
   QCommandLineOption debugOpt{{"d", "debug"}, "Does nothing. Provided for ditaa command-line compatibility."};
@@ -142,8 +217,9 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
   auto formats = QImageWriter::supportedImageFormats();
   formats.removeOne("cur");
   formats.removeOne("ico");
-  formats << "svg" << "pdf";
+  formats << "pam" << "ppm" << "raw" << "svg" << "svgz" << "pdf";
   std::sort(formats.begin(), formats.end());
+  formats.erase(std::unique(formats.begin(), formats.end()), formats.end());
 
   QCommandLineParser parser;
   parser.setApplicationDescription(QStringLiteral(
@@ -152,7 +228,9 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
     "recognized and rendered as lines. There are more features for drawing "
     "dashed lines, filling shapes and setting text.\n\n"
     "The format of the output image is determined from its suffix. The "
-    "following formats are supported: %1.").arg(QString::fromLatin1(formats.join(", "))));
+    "following formats are supported: %1. The pam, ppm and raw formats hold "
+    "uncompressed pixels; raw files have no header and RGBA or, with "
+    "--grayscale, 8 bit gray pixels.").arg(QString::fromLatin1(formats.join(", "))));
 
   switch (mode)
   {
@@ -162,14 +240,23 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
       parser.addOption(encodingOpt);
       parser.addOption(fontOpt);
       parser.addOption(fontSizeOpt);
+      parser.addOption(formatOpt);
+      parser.addOption(grayscaleOpt);
       parser.addHelpOption();
       parser.addOption(lineWdOpt);
+      parser.addOption(manifestOpt);
       parser.addOption(outputFileOpt);
+      parser.addOption(pngCompressionOpt);
+      parser.addOption(pngFilterOpt);
+      parser.addOption(scalesOpt);
       parser.addOption(shadowOpt);
       parser.addOption(noShadowOpt);
+      parser.addOption(shadowFilterOpt);
+      parser.addOption(shadowSizeOpt);
       parser.addOption(tabsOpt);
+      parser.addOption(threadsOpt);
       parser.addVersionOption();
-      parser.addPositionalArgument("input", "Input file that contains the drawing.");
+      parser.addPositionalArgument("input", "Input files that contain the drawings. Several files are written as pages of one PDF file, or each to its own output files if their names contain %n.", "input...");
       parser.process(app);
       break;
 
@@ -199,6 +286,9 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
   }
 
   auto posArgs = parser.positionalArguments();
+  if (mode == Mode::Drawscii && parser.isSet(manifestOpt))
+    posArgs << readManifest(parser.value(manifestOpt));
+
   if (posArgs.isEmpty())
     throw std::runtime_error{"Missing input file"};
 
@@ -209,9 +299,6 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
   {
     case Mode::Drawscii:
     {
-      if (posArgs.size() > 1)
-        throw std::runtime_error{"Too many input files"};
-
       if (parser.isSet(fontOpt))
         result.font.setFamily(parser.value(fontOpt));
 
@@ -224,10 +311,65 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
       if (parser.isSet(backgroundOpt))
         result.bg = parseColorArg(parser.value(backgroundOpt), "Invalid background color");
 
+      if (parser.isSet(shadowSizeOpt))
+        result.shadowSize = parseIntArg(parser.value(shadowSizeOpt), 1, 256, "Invalid shadow size");
+
+      if (parser.isSet(shadowFilterOpt))
+      {
+        auto filter = parser.value(shadowFilterOpt);
+        if (filter == "recursive")
+          result.shadowFilter = BlurMethod::Recursive;
+        else if (filter != "box")
+          throw std::runtime_error{"Invalid shadow filter"};
+      }
+
+      if (parser.isSet(pngCompressionOpt))
+      {
+        auto level = parser.value(pngCompressionOpt);
+        if (level == "fast")
+          result.png.setCompression(1);
+        else if (level == "max")
+          result.png.setMaximumCompression(true);
+        else
+          result.png.setCompression(parseIntArg(level, 0, 9, "Invalid PNG compression"));
+      }
+
+      if (parser.isSet(pngFilterOpt))
+        result.png.setFilter(parsePngFilterArg(parser.value(pngFilterOpt), "Invalid PNG filter"));
+
+      if (parser.isSet(threadsOpt))
+        result.threads = parseIntArg(parser.value(threadsOpt), 1, 1024, "Invalid number of threads");
+
       result.antialias  = !parser.isSet(antialiasOpt);
+      result.grayscale  = parser.isSet(grayscaleOpt);
       result.shadows    = parser.isSet(shadowOpt) - parser.isSet(noShadowOpt);
-      result.inputFile  = posArgs[0];
-      result.outputFile = parser.value(outputFileOpt);
+      result.inputFiles = posArgs;
+
+      if (parser.isSet(scalesOpt))
+      {
+        result.scales.clear();
+        for (auto& value: parser.value(scalesOpt).split(','))
+        {
+          auto scale = parseFloatArg(value, "Invalid scale");
+          if (!(scale > 0 && scale <= 16) || std::count(result.scales.begin(), result.scales.end(), scale))
+            throw std::runtime_error{"Invalid scale"};
+
+          result.scales.push_back(scale);
+        }
+      }
+
+      for (auto scale: result.scales)
+        for (auto& file: parser.values(outputFileOpt))
+        {
+          if (result.scales.size() > 1 && !file.contains("%s"))
+            throw std::runtime_error{"Output file names must contain %s for several scales"};
+
+          auto name = QString{file}.replace("%s", QString::number(static_cast<double>(scale)));
+          result.outputs.push_back({name, parser.value(formatOpt).toLatin1(), scale});
+        }
+
+      if (parser.isSet(formatOpt) && parser.values(outputFileOpt).size() > 1)
+        throw std::runtime_error{"The output format can only be set for a single output file"};
       break;
     }
 
@@ -249,17 +391,17 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
         result.font.setPixelSize(qRound(result.font.pixelSize() * scale));
       }
 
-      result.antialias = !parser.isSet(antialiasOpt);
-      result.shadows   = (parser.isSet(noShadowOpt) ? -1 : 1);
-      result.overwrite = parser.isSet(outputFileOpt);
-      result.inputFile = posArgs[0];
+      result.antialias  = !parser.isSet(antialiasOpt);
+      result.shadows    = (parser.isSet(noShadowOpt) ? -1 : 1);
+      result.overwrite  = parser.isSet(outputFileOpt);
+      result.inputFiles = QStringList{posArgs[0]};
 
       if (posArgs.size() >= 2)
-        result.outputFile = posArgs[1];
+        result.outputs.push_back({posArgs[1], {}, 1});
       else
       {
-        QFileInfo fi{result.inputFile};
-        result.outputFile = fi.dir().filePath(fi.completeBaseName() + ".png");
+        QFileInfo fi{posArgs[0]};
+        result.outputs.push_back({fi.dir().filePath(fi.completeBaseName() + ".png"), {}, 1});
       }
       break;
     }
@@ -272,9 +414,30 @@ CmdLineArgs processCmdLine(const QCoreApplication& app, Mode mode)
   if (parser.isSet(tabsOpt))
     result.tabWidth = parseUintArg(parser.value(tabsOpt), 1, 16, "Invalid tab width");
 
-  if (result.outputFile.isEmpty())
+  if (result.outputs.empty())
     throw std::runtime_error{"Missing output file"};
 
+  for (auto& output: result.outputs)
+  {
+    if (output.file.isEmpty())
+      throw std::runtime_error{"Missing output file"};
+
+    if (output.format.isEmpty() && output.file != "-")
+      output.format = QFileInfo{output.file}.suffix().toLatin1();
+
+    if (output.format.isEmpty())
+      throw std::runtime_error{"Missing output format"};
+  }
+
+  if (result.inputFiles.size() > 1)
+  {
+    bool batch = std::all_of(result.outputs.begin(), result.outputs.end(), [](const Output& output)
+                             { return output.file.contains("%n"); });
+    bool pages = (result.outputs.size() == 1 && result.outputs.front().format == "pdf");
+    if (!batch && !pages)
+      throw std::runtime_error{"Several input files need %n in the output file names, or a single PDF file"};
+  }
+
   return result;
 }
 
@@ -311,60 +474,353 @@ TextImage readTextImage(QString fname, QTextCodec* codec, uint tabWidth)
 
 
 
-void renderSvg(Render& render, const CmdLineArgs& args)
+/// An input file with all the analysis results that Render objects refer to.
+/// They do not depend on the scale, so all scales share them.
+struct Drawing
+{
+  Drawing(const QString& fname, const CmdLineArgs& args);
+
+  TextImage text;
+  Graph graph;
+  Shapes shapes;
+  Hints hints;
+  ParagraphList paras;
+};
+
+
+
+Drawing::Drawing(const QString& fname, const CmdLineArgs& args)
+  : text{readTextImage(fname, args.codec, args.tabWidth)},
+    graph{constructGraph(text)},
+    shapes{findShapes(graph)},
+    hints{findHints(text)},
+    paras{findParagraphs(text)}
+{}
+
+
+
+/// Sets up \a render with the drawing options of the command line. Font size,
+/// line width and shadow size are multiplied by \a scale.
+void setupRender(Render& render, const CmdLineArgs& args, float scale)
+{
+  auto font = args.font;
+  font.setPixelSize(std::max(1, qRound(font.pixelSize() * scale)));
+
+  render.setFont(font);
+  render.setLineWidth(args.lineWd * scale);
+  render.setShadowSize(std::max(1, qRound(args.shadowSize * scale)), args.shadowFilter);
+  render.setAntialias(args.antialias);
+}
+
+
+
+bool isVectorFormat(const QByteArray& format) noexcept
+{ return format == "svg" || format == "svgz" || format == "pdf"; }
+
+
+
+bool isRawFormat(const QByteArray& format) noexcept
+{ return format == "pam" || format == "ppm" || format == "raw"; }
+
+
+
+/// The shadows drawn for the given output \a format. Vector formats can only
+/// have simple shadows, which are off by default.
+Shadow shadowMode(const QByteArray& format, const CmdLineArgs& args) noexcept
 {
-  OutputFile fd{args.outputFile};
-  QSvgGenerator svg;
-  svg.setOutputDevice(&fd);
-  svg.setViewBox(QRect{QPoint{0, 0}, render.size()});
+  if (isVectorFormat(format))
+    return (args.shadows > 0 ? Shadow::Simple : Shadow::None);
+
+  return (args.shadows >= 0 ? Shadow::Blurred : Shadow::None);
+}
 
-  render.setShadows(args.shadows > 0 ? Shadow::Simple : Shadow::None);
-  render.paint(&svg);
+
+
+/// Creates the output file \a name and passes it to \a write. Errors are
+/// reported with the file name, and the incomplete file is removed.
+template<typename Write>
+void writeFile(const QString& name, Write write)
+try
+{
+  OutputFile fd{name};
+  write(fd);
   fd.done();
 }
+catch (const RuntimeError&)
+{ throw; }
+catch (const std::runtime_error& e)
+{ throw RuntimeError{name, ": ", QString::fromLocal8Bit(e.what())}; }
+
+
+
+void writeSvg(const Render& render, const DisplayList& list, const Output& output)
+{
+  writeFile(output.file, [&](OutputFile& fd)
+  {
+    SvgWriter svg{fd};
+    svg.setCompressed(output.format == "svgz");
+    svg.write(list, render.size(), render.origin());
+  });
+}
 
 
 
-void renderPdf(Render& render, const CmdLineArgs& args)
+void checkPdfArgs(const CmdLineArgs& args)
 {
   if (args.bg != Qt::white)
     throw std::runtime_error{"PDF output format must not have background color"};
 
   if (!args.antialias)
     std::clog << "warning: Anti-alias cannot be disabled for PDF output" << std::endl;
+}
 
-  OutputFile fd{args.outputFile};
-  QPdfWriter writer{&fd};
-  writer.setPageSize(QPageSize(render.size(), QPageSize::Point));
+
+
+void setupPdfWriter(QPdfWriter& writer)
+{
   writer.setPageMargins(QMarginsF{});
   writer.setResolution(72 /*dpi*/);
+}
 
-  render.setShadows(args.shadows > 0 ? Shadow::Simple : Shadow::None);
-  render.paint(&writer);
-  fd.done();
+
+
+/// Starts a new page of the size of the drawing, and paints the \a list onto
+/// it. The \a painter is begun on the first page.
+void paintPdfPage(QPdfWriter& writer, QPainter& painter, const Render& render, const DisplayList& list)
+{
+  writer.setPageSize(QPageSize(render.size(), QPageSize::Point));
+  if (!painter.isActive())
+  {
+    if (!painter.begin(&writer))
+      throw std::runtime_error{"Cannot write PDF file"};
+  }
+  else if (!writer.newPage())
+    throw std::runtime_error{"Cannot write PDF file"};
+
+  render.paint(painter, list);
+}
+
+
+
+void writePdf(const Render& render, const DisplayList& list, const Output& output)
+{
+  writeFile(output.file, [&](OutputFile& fd)
+  {
+    QPdfWriter writer{&fd};
+    setupPdfWriter(writer);
+
+    QPainter painter;
+    paintPdfPage(writer, painter, render, list);
+    painter.end();
+  });
+}
+
+
+
+/// Writes all input files as pages of one PDF file.
+void writePdfPages(const CmdLineArgs& args)
+{
+  auto& output = args.outputs.front();
+  writeFile(output.file, [&](OutputFile& fd)
+  {
+    QPdfWriter writer{&fd};
+    setupPdfWriter(writer);
+
+    // All drawings go through the same painter, so that every font subset
+    // is embedded only once into the document
+    QPainter painter;
+    for (const auto& fname : args.inputFiles)
+    {
+      Drawing drawing{fname, args};
+      Render render{drawing.text, drawing.graph, drawing.shapes, drawing.hints, drawing.paras};
+      setupRender(render, args, output.scale);
+      render.setShadows(shadowMode(output.format, args));
+      paintPdfPage(writer, painter, render, render.displayList());
+    }
+
+    painter.end();
+  });
+}
+
+
+
+/// PNG and raw files are painted in strips of about this many pixels, but at
+/// least MinStripHeight rows.
+constexpr int StripPixels    = 16 * 1024 * 1024;
+constexpr int MinStripHeight = 64;
+
+
+
+/// Paints the display \a list in horizontal strips of the given \a format and
+/// passes them to \a write, so that even huge drawings only need the memory
+/// for one strip.
+template<typename Write>
+void paintStrips(const Render& render, const DisplayList& list, QImage::Format format, const QColor& bg, Write write)
+{
+  auto width  = render.size().width();
+  auto height = render.size().height();
+  auto strip  = std::max(MinStripHeight, StripPixels / std::max(width, 1));
+
+  for (int top = 0; top < height; top += strip)
+  {
+    QImage img{width, std::min(strip, height - top), format};
+    img.fill(bg);
+    render.paintTiled(img, list, top);
+    write(img);
+  }
+}
+
+
+
+void checkBitmapArgs(const QByteArray& format, const CmdLineArgs& args)
+{
+  bool transparency = (args.bg.alpha() != 255);
+  if (transparency && format != "png" && format != "pam" && format != "raw")
+    throw std::runtime_error{"Must use PNG, PAM or raw output format for transparent background"};
+
+  if (transparency && args.grayscale && (format == "pam" || format == "raw"))
+    throw std::runtime_error{"Grayscale PAM and raw output formats must not have transparent background"};
 }
 
 
 
-void renderBitmap(Render& render, const QByteArray& suffix, const CmdLineArgs& args)
+void writeBitmap(const Render& render, const DisplayList& list, const Output& output, const CmdLineArgs& args)
 {
   bool transparency = (args.bg.alpha() != 255);
-  if (transparency && suffix != "png")
-    throw std::runtime_error{"Must use PNG output format for transparent background"};
+  bool grayBg = (args.bg.red() == args.bg.green() && args.bg.green() == args.bg.blue());
+  bool gray   = (!transparency && grayBg && render.isGrayscale());
+  auto format = (transparency ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32);
+
+  // Drawings without colors are written as grayscale PNG files. They need a
+  // quarter of the memory for painting, and give considerably smaller files
+  auto& suffix = output.format;
+  if (suffix == "png" && gray)
+    format = QImage::Format_Grayscale8;
+
+  if (isRawFormat(suffix))
+  {
+    // The layout of the file only depends on the options. The strips are
+    // painted right into it, so they can be written out without conversion,
+    // except for colored drawings in a grayscale file
+    auto header = (suffix == "pam" ? RawStream::Header::Pam
+                                   : (suffix == "ppm" ? RawStream::Header::Ppm : RawStream::Header::None));
+    auto rawFormat = RawStream::imageFormat(header, transparency, args.grayscale);
+    if (rawFormat != QImage::Format_Grayscale8 || gray)
+      format = rawFormat;
+
+    writeFile(output.file, [&](OutputFile& fd)
+    {
+      RawStream raw{fd, header, render.size().width(), render.size().height(), rawFormat};
+      paintStrips(render, list, format, args.bg, [&](const QImage& strip)
+      { raw.write(strip.format() == rawFormat ? strip : strip.convertToFormat(rawFormat)); });
+      raw.finish();
+    });
+    return;
+  }
+
+  if (suffix == "png" && !args.png.maximumCompression())
+  {
+    writeFile(output.file, [&](OutputFile& fd)
+    {
+      PngStream png{args.png, fd, render.size().width(), render.size().height(), format};
+      paintStrips(render, list, format, args.bg, [&](const QImage& strip) { png.write(strip); });
+      png.finish();
+    });
+    return;
+  }
 
-  QImage img{render.size(), (transparency ? QImage::Format_ARGB32_Premultiplied : QImage::Format_RGB32)};
+  QImage img{render.size(), format};
   img.fill(args.bg);
+  render.paintTiled(img, list, 0);
 
-  render.setShadows(args.shadows >= 0 ? Shadow::Blurred : Shadow::None);
-  render.setAntialias(args.antialias);
-  render.paint(&img);
+  writeFile(output.file, [&](OutputFile& fd)
+  {
+    if (suffix == "png")
+      args.png.write(fd, img);
+    else
+    {
+      QImageWriter writer{&fd, suffix};
+      if (!writer.write(img))
+        throw std::runtime_error{writer.errorString().toLocal8Bit().toStdString()};
+    }
+  });
+}
 
-  OutputFile fd{args.outputFile};
-  QImageWriter writer{&fd, suffix};
-  if (!writer.write(img))
-    throw RuntimeError{fd.fileName(), ": ", writer.errorString()};
 
-  fd.done();
+
+/// The outputs for the input file \a fname: %n in the file names is replaced
+/// by its base name, and %d by its directory.
+std::vector<Output> inputOutputs(const std::vector<Output>& outputs, const QString& fname)
+{
+  QFileInfo fi{fname};
+  auto result = outputs;
+  for (auto& output: result)
+    output.file.replace("%n", fi.completeBaseName()).replace("%d", fi.path());
+
+  return result;
+}
+
+
+
+/// Analyzes the input file \a fname once, and writes all \a outputs of it.
+void processInput(const QString& fname, const std::vector<Output>& outputs, const CmdLineArgs& args)
+{
+  // All outputs share the analysis of the input file. Outputs with the same
+  // scale and shadows also share a Render object and its display list; the
+  // shadows may change the size of the drawing. The outputs of a group are
+  // painted and written concurrently.
+  struct Group
+  {
+    float scale;
+    Shadow shadows;
+    std::vector<const Output*> outputs;
+  };
+
+  std::vector<Group> groups;
+  for (auto& output: outputs)
+  {
+    auto shadows = shadowMode(output.format, args);
+    auto group   = std::find_if(groups.begin(), groups.end(), [&](const Group& g)
+                                { return g.scale == output.scale && g.shadows == shadows; });
+
+    if (group == groups.end())
+      group = groups.insert(group, Group{output.scale, shadows, {}});
+
+    group->outputs.push_back(&output);
+  }
+
+  Drawing drawing{fname, args};
+
+  parallelFor(static_cast<int>(groups.size()), [&](int g)
+  {
+    auto& group = groups[static_cast<size_t>(g)];
+    Render render{drawing.text, drawing.graph, drawing.shapes, drawing.hints, drawing.paras};
+    setupRender(render, args, group.scale);
+    render.setShadows(group.shadows);
+    auto list = render.displayList();
+
+    parallelFor(static_cast<int>(group.outputs.size()), [&](int i)
+    {
+      auto& output = *group.outputs[static_cast<size_t>(i)];
+
+      if (output.format == "pdf")
+        writePdf(render, list, output);
+      else if (isVectorFormat(output.format))
+        writeSvg(render, list, output);
+      else
+        writeBitmap(render, list, output, args);
+    });
+  });
+}
+
+
+
+void checkOverwrite(const std::vector<Output>& outputs, const CmdLineArgs& args)
+{
+  if (!args.overwrite)
+    for (auto& output: outputs)
+      if (output.file != "-" && QFileInfo::exists(output.file))
+        throw RuntimeError{output.file, ": File already exists and will not be overwritten"};
 }
 
 
@@ -378,39 +834,97 @@ try
   app.setApplicationName("drawscii");
   app.setApplicationVersion(VERSION);
 
-  auto mode   = (QFileInfo{argv[0]}.fileName() == "ditaa" ? Mode::Ditaa : Mode::Drawscii);
-  auto args   = processCmdLine(app, mode);
-  auto text   = readTextImage(args.inputFile, args.codec, args.tabWidth);
-  auto graph  = constructGraph(text);
-  auto shapes = findShapes(graph);
-  auto hints  = findHints(text);
-  auto paras  = findParagraphs(text);
+  auto mode = (QFileInfo{argv[0]}.fileName() == "ditaa" ? Mode::Ditaa : Mode::Drawscii);
+  auto args = processCmdLine(app, mode);
+  if (args.threads)
+    QThreadPool::globalInstance()->setMaxThreadCount(args.threads);
 
-  Render render{text, graph, shapes, hints, paras};
-  render.setFont(args.font);
-  render.setLineWidth(args.lineWd);
+  for (auto& output: args.outputs)
+  {
+    if (output.format == "pdf")
+      checkPdfArgs(args);
+    else if (isRawFormat(output.format) || QImageWriter::supportedImageFormats().contains(output.format))
+      checkBitmapArgs(output.format, args);
+    else if (!isVectorFormat(output.format))
+      throw RuntimeError{output.file, ": Unknown graphics format"};
+  }
 
-  QFileInfo outputInfo{args.outputFile};
-  if (!args.overwrite && outputInfo.exists())
-    throw RuntimeError{args.outputFile, ": File already exists and will not be overwritten"};
+  if (args.inputFiles.size() > 1 && !args.outputs.front().file.contains("%n"))
+  {
+    checkOverwrite(args.outputs, args);
+    writePdfPages(args);
+    return 0;
+  }
 
-  if (mode == Mode::Ditaa)
+  auto count = static_cast<int>(args.inputFiles.size());
+  std::vector<std::vector<Output>> outputs;
+  QSet<QString> outputFiles;
+  for (auto& fname: args.inputFiles)
   {
-    std::cout << "Reading file: " << qPrintable(args.inputFile) << '\n';
-    std::cout << "Rendering to file: " << qPrintable(outputInfo.absoluteFilePath()) << std::endl;
+    outputs.push_back(inputOutputs(args.outputs, fname));
+    for (auto& output: outputs.back())
+    {
+      if (output.file != "-" && outputFiles.contains(output.file))
+        throw RuntimeError{output.file, ": Output file would be written for several input files"};
+
+      outputFiles.insert(output.file);
+    }
   }
 
-  auto suffix = outputInfo.suffix().toLatin1();
-  if (suffix == "svg")
-    renderSvg(render, args);
-  else if (suffix == "pdf")
-    renderPdf(render, args);
-  else if (QImageWriter::supportedImageFormats().contains(suffix))
-    renderBitmap(render, suffix, args);
-  else
-    throw RuntimeError{args.outputFile, ": Unknown graphics format"};
+  // The input files are processed in parallel, the largest first, so that
+  // small ones fill the gaps at the end. Each of them is read, analyzed,
+  // painted and written on its own, so that I/O of some files overlaps with
+  // the computations for others. The threads that parallelFor() leaves idle
+  // help with painting and compressing large files.
+  std::vector<int> order(static_cast<size_t>(count));
+  std::vector<qint64> sizes;
+  for (auto& fname: args.inputFiles)
+    sizes.push_back(QFileInfo{fname}.size());
+
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b)
+                   { return sizes[static_cast<size_t>(a)] > sizes[static_cast<size_t>(b)]; });
+
+  // An error only stops the input file it occurred in. The messages and
+  // errors are reported in the order of the input files after all of them
+  // are done, and the exit code tells whether any failed.
+  std::vector<std::string> messages(static_cast<size_t>(count));
+  std::vector<std::string> errors(static_cast<size_t>(count));
+  parallelFor(count, [&](int k)
+  {
+    auto i      = static_cast<size_t>(order[static_cast<size_t>(k)]);
+    auto& fname = args.inputFiles[static_cast<int>(i)];
+
+    try
+    {
+      checkOverwrite(outputs[i], args);
+
+      if (mode == Mode::Ditaa)
+      {
+        auto message = "Reading file: " + fname + "\nRendering to file: " + QFileInfo{outputs[i].front().file}.absoluteFilePath() + '\n';
+        messages[i] = message.toLocal8Bit().toStdString();
+      }
+
+      processInput(fname, outputs[i], args);
+    }
+    catch (const std::runtime_error& e)
+    { errors[i] = std::string{"error: "} + e.what(); }
+    catch (const std::exception& e)
+    { errors[i] = std::string{"internal error: "} + e.what(); }
+  });
+
+  bool failed = false;
+  for (size_t i = 0; i < errors.size(); ++i)
+  {
+    std::cout << messages[i] << std::flush;
+    if (!errors[i].empty())
+    {
+      std::clog << errors[i] << '\n';
+      failed = true;
+    }
+  }
 
-  return 0;
+  return (failed ? 1 : 0);
 }
 catch (const std::runtime_error& e)
 {
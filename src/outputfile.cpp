@@ -17,15 +17,25 @@
 */
 #include "outputfile.h"
 #include "runtimeerror.h"
+#include <unistd.h>
 
 
 
 OutputFile::OutputFile(const QString& name)
-  : QFile{name},
+  : mName{name},
     mDone{false}
 {
-  if (!open(WriteOnly|Truncate))
-    throw RuntimeError{name, ": ", errorString()};
+  if (name == "-")
+  {
+    if (!open(STDOUT_FILENO, WriteOnly))
+      throw RuntimeError{name, ": ", errorString()};
+  }
+  else
+  {
+    setFileName(name);
+    if (!open(WriteOnly|Truncate))
+      throw RuntimeError{name, ": ", errorString()};
+  }
 }
 
 
@@ -35,7 +45,8 @@ OutputFile::~OutputFile()
   if (!mDone)
   {
     close();
-    remove();
+    if (mName != "-")
+      remove();
   }
 }
 
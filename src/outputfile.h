@@ -22,7 +22,8 @@
 
 
 /// Simple QFile wrapper for the output image file that removes the created
-/// file if done() is not called - which happens upon errors.
+/// file if done() is not called - which happens upon errors. The name "-"
+/// stands for the standard output.
 ///
 class OutputFile : public QFile
 {
@@ -30,10 +31,16 @@ class OutputFile : public QFile
     explicit OutputFile(const QString& name);
     ~OutputFile() override;
 
+    /// The name passed to the constructor. Unlike fileName(), it is also set
+    /// for the standard output.
+    const QString& name() const noexcept
+    { return mName; }
+
     /// Called upon successful generation of the output image file; it will no
     /// longer be removed upon destruction of this object.
     void done();
 
   private:
+    QString mName;
     bool mDone;
 };
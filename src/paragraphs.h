@@ -80,8 +80,6 @@ class Paragraph
     /// Alignment of the whole paragraph as deduced from text input.
     Qt::Alignment alignment() const noexcept;
 
-    mutable Color color;
-
   private:
     struct Row {
       Row(wstring_view s, int i) noexcept;
@@ -0,0 +1,100 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThreadPool>
+
+
+
+namespace {
+class Worker : public QRunnable
+{
+  public:
+    Worker(const std::function<void()>& fn, QSemaphore& done) noexcept
+      : mFn{fn},
+        mDone{done}
+    {}
+
+    void run() override
+    {
+      mFn();
+      mDone.release();
+    }
+
+  private:
+    const std::function<void()>& mFn;
+    QSemaphore& mDone;
+};
+} // namespace
+
+
+
+void parallelFor(int count, const std::function<void(int)>& fn)
+{
+  std::atomic<int>   next{0};
+  std::exception_ptr error;
+  std::mutex         errorMtx;
+
+  std::function<void()> work = [&]
+  {
+    for (int i; (i = next++) < count;)
+    {
+      try
+      {
+        fn(i);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock{errorMtx};
+        if (!error)
+          error = std::current_exception();
+      }
+    }
+  };
+
+  auto pool    = QThreadPool::globalInstance();
+  int  helpers = std::min(count, parallelism()) - 1;
+  int  started = 0;
+
+  QSemaphore done;
+  for (; started < helpers; ++started)
+  {
+    auto worker = new Worker{work, done};
+    if (!pool->tryStart(worker))
+    {
+      delete worker;
+      break;
+    }
+  }
+
+  work();
+  done.acquire(started);
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+
+
+int parallelism() noexcept
+{ return std::max(QThreadPool::globalInstance()->maxThreadCount(), 1); }
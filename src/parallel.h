@@ -0,0 +1,32 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "common.h"
+#include <functional>
+
+
+
+/// Calls \a fn(i) for all i in [0, \a count) on the threads of the global
+/// QThreadPool, and returns when all calls are done. The calling thread takes
+/// part in the work, so that progress is made even if the pool is busy, and
+/// calls from within \a fn do not dead-lock. If \a fn throws, the first
+/// exception is rethrown after all other calls have finished.
+void parallelFor(int count, const std::function<void(int)>& fn);
+
+/// The number of threads parallelFor() uses at most.
+int parallelism() noexcept;
@@ -0,0 +1,479 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "pngwriter.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+#include <QBuffer>
+#include <QIODevice>
+
+
+
+namespace {
+/// Strips of about this many bytes of filtered rows are deflated in parallel.
+constexpr int StripBytes = 256 * 1024;
+
+/// The size of the deflate window, and of the dictionary that a strip takes
+/// over from the previous one.
+constexpr int WindowBytes = 32 * 1024;
+
+
+
+/// How the pixels of an image are stored in the PNG file.
+struct Layout
+{
+  Layout(int width, QImage::Format format);
+  QImage convert(const QImage& img) const;
+
+  QImage::Format format; // of the converted images
+  quint8 colorType;      // as in the IHDR chunk
+  int channels;          // bytes per pixel
+  int rowBytes;          // bytes per row, without the filter type byte
+};
+
+
+
+Layout::Layout(int width, QImage::Format fmt)
+{
+  if (fmt == QImage::Format_Grayscale8)
+  {
+    format    = fmt;
+    colorType = 0;
+    channels  = 1;
+  }
+  else if (QImage::toPixelFormat(fmt).alphaUsage() == QPixelFormat::UsesAlpha)
+  {
+    format    = QImage::Format_ARGB32;
+    colorType = 6;
+    channels  = 4;
+  }
+  else
+  {
+    format    = QImage::Format_RGB32;
+    colorType = 2;
+    channels  = 3;
+  }
+
+  rowBytes = width * channels;
+}
+
+
+
+/// The \a img in the format whose rows packRow() can store.
+inline QImage Layout::convert(const QImage& img) const
+{ return img.convertToFormat(format); }
+
+
+
+/// Stores row \a y of \a img, which was converted by the \a layout, into
+/// \a out in PNG byte order.
+void packRow(const Layout& layout, const QImage& img, int y, uchar* out)
+{
+  if (layout.channels == 1)
+  {
+    std::copy_n(img.constScanLine(y), layout.rowBytes, out);
+    return;
+  }
+
+  auto px = reinterpret_cast<const QRgb*>(img.constScanLine(y));
+  for (int x = 0; x < img.width(); ++x)
+  {
+    *out++ = static_cast<uchar>(qRed(px[x]));
+    *out++ = static_cast<uchar>(qGreen(px[x]));
+    *out++ = static_cast<uchar>(qBlue(px[x]));
+
+    if (layout.channels == 4)
+      *out++ = static_cast<uchar>(qAlpha(px[x]));
+  }
+}
+
+
+
+inline uchar paeth(int a, int b, int c) noexcept
+{
+  int p  = a + b - c;
+  int pa = std::abs(p - a);
+  int pb = std::abs(p - b);
+  int pc = std::abs(p - c);
+
+  if (pa <= pb && pa <= pc)
+    return static_cast<uchar>(a);
+
+  return static_cast<uchar>(pb <= pc ? b : c);
+}
+
+
+
+/// Writes the filter type and the \a n bytes of \a cur filtered with \a
+/// filter, which must not be Adaptive, to \a out. \a prev is the previous
+/// unfiltered row, \a bpp the number of bytes per pixel.
+void filterRow(PngWriter::Filter filter, const uchar* cur, const uchar* prev, int bpp, int n, uchar* out)
+{
+  *out++ = static_cast<uchar>(filter);
+
+  for (int i = 0; i < n; ++i)
+  {
+    int a = (i >= bpp ? cur[i - bpp] : 0);
+    int b = prev[i];
+    int c = (i >= bpp ? prev[i - bpp] : 0);
+
+    switch (filter)
+    {
+      case PngWriter::Filter::None:    out[i] = cur[i]; break;
+      case PngWriter::Filter::Sub:     out[i] = static_cast<uchar>(cur[i] - a); break;
+      case PngWriter::Filter::Up:      out[i] = static_cast<uchar>(cur[i] - b); break;
+      case PngWriter::Filter::Average: out[i] = static_cast<uchar>(cur[i] - ((a + b) >> 1)); break;
+      case PngWriter::Filter::Paeth:   out[i] = static_cast<uchar>(cur[i] - paeth(a, b, c)); break;
+      case PngWriter::Filter::Adaptive: assert(false); break;
+    }
+  }
+}
+
+
+
+/// The sum of the filtered bytes of a row as signed values, which libpng uses
+/// to choose the filter that probably compresses best.
+uint filterCost(const uchar* row, int n) noexcept
+{
+  uint sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += (row[i] < 128 ? row[i] : 256u - row[i]);
+
+  return sum;
+}
+
+
+
+/// The rows [\a begin, \a end) of \a img, which was converted by the \a
+/// layout, each with a filter type byte in front and filtered with \a
+/// filter. \a above is the unfiltered row above \a img.
+QByteArray filterRows(const Layout& layout, const QImage& img, PngWriter::Filter filter, int begin, int end, const std::vector<uchar>& above)
+{
+  int n = layout.rowBytes;
+  QByteArray result{(end - begin) * (n + 1), Qt::Uninitialized};
+
+  std::vector<uchar> prev{above};
+  std::vector<uchar> cur(static_cast<size_t>(n));
+  std::vector<uchar> trial(static_cast<size_t>(n) + 1);
+
+  if (begin > 0)
+    packRow(layout, img, begin - 1, prev.data());
+
+  auto out = reinterpret_cast<uchar*>(result.data());
+  for (int y = begin; y < end; ++y, out += n + 1)
+  {
+    packRow(layout, img, y, cur.data());
+
+    if (filter != PngWriter::Filter::Adaptive)
+      filterRow(filter, cur.data(), prev.data(), layout.channels, n, out);
+    else
+    {
+      uint best = ~0u;
+      for (auto f: {PngWriter::Filter::None, PngWriter::Filter::Sub, PngWriter::Filter::Up, PngWriter::Filter::Average, PngWriter::Filter::Paeth})
+      {
+        filterRow(f, cur.data(), prev.data(), layout.channels, n, trial.data());
+
+        auto cost = filterCost(trial.data() + 1, n);
+        if (cost < best)
+        {
+          best = cost;
+          std::copy(trial.begin(), trial.end(), out);
+        }
+      }
+    }
+
+    std::swap(prev, cur);
+  }
+
+  return result;
+}
+
+
+
+/// Deflates \a data to a raw deflate stream. Unless it is the \a last part
+/// of the stream, it ends with a sync flush, so that the next part can be
+/// appended. The \a dictionary is the data preceding this part.
+QByteArray deflatePart(const QByteArray& data, const QByteArray& dictionary, int level, int strategy, bool last)
+{
+  z_stream zs{};
+  if (deflateInit2(&zs, level, Z_DEFLATED, -15, level == 9 ? 9 : 8, strategy) != Z_OK)
+    throw std::runtime_error{"Failed to initialize zlib"};
+
+  if (!dictionary.isEmpty())
+    deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(dictionary.constData()), static_cast<uInt>(dictionary.size()));
+
+  QByteArray result{static_cast<int>(deflateBound(&zs, static_cast<uLong>(data.size()))) + 16, Qt::Uninitialized};
+
+  zs.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+  zs.avail_in = static_cast<uInt>(data.size());
+
+  int flush = (last ? Z_FINISH : Z_SYNC_FLUSH);
+  for (;;)
+  {
+    zs.next_out  = reinterpret_cast<Bytef*>(result.data()) + zs.total_out;
+    zs.avail_out = static_cast<uInt>(result.size()) - static_cast<uInt>(zs.total_out);
+
+    int ret = deflate(&zs, flush);
+    if (ret == Z_STREAM_ERROR)
+    {
+      deflateEnd(&zs);
+      throw std::runtime_error{"Failed to compress PNG image data"};
+    }
+
+    if (last ? ret == Z_STREAM_END : zs.avail_out != 0)
+      break;
+
+    result.resize(result.size() * 2);
+  }
+
+  result.resize(static_cast<int>(zs.total_out));
+  deflateEnd(&zs);
+
+  return result;
+}
+
+
+
+inline void appendUint32(QByteArray& out, quint32 value)
+{
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.append(static_cast<char>((value >> shift) & 0xff));
+}
+
+
+
+void writeChunk(QIODevice& dev, const char* type, const QByteArray& data)
+{
+  QByteArray chunk;
+  chunk.reserve(data.size() + 12);
+  appendUint32(chunk, static_cast<quint32>(data.size()));
+  chunk.append(type, 4);
+  chunk.append(data);
+  appendUint32(chunk, static_cast<quint32>(crc32(0, reinterpret_cast<const Bytef*>(chunk.constData() + 4), static_cast<uInt>(data.size() + 4))));
+
+  if (dev.write(chunk) != chunk.size())
+    throw std::runtime_error{dev.errorString().toStdString()};
+}
+} // namespace
+
+
+
+PngWriter::PngWriter() noexcept
+  : mLevel{6},
+    mStrategy{Z_DEFAULT_STRATEGY},
+    mFilter{Filter::Adaptive},
+    mMaximum{false}
+{}
+
+
+
+void PngWriter::setCompression(int level)
+{
+  if (level < 0 || level > 9)
+    throw std::runtime_error{"Invalid PNG compression level"};
+
+  mLevel = level;
+}
+
+
+
+void PngWriter::setFilter(Filter filter) noexcept
+{ mFilter = filter; }
+
+
+void PngWriter::setMaximumCompression(bool enable) noexcept
+{ mMaximum = enable; }
+
+
+
+void PngWriter::write(QIODevice& dev, const QImage& img) const
+{
+  if (!mMaximum)
+  {
+    PngStream stream{*this, dev, img.width(), img.height(), img.format()};
+    stream.write(img);
+    stream.finish();
+    return;
+  }
+
+  // Every combination of filter and strategy, and keep the smallest file
+  static const Filter filters[] = {Filter::None, Filter::Sub, Filter::Up, Filter::Average, Filter::Paeth, Filter::Adaptive};
+  static const int strategies[] = {Z_DEFAULT_STRATEGY, Z_FILTERED};
+  std::vector<QByteArray> trials(12);
+
+  parallelFor(12, [&](int i)
+  {
+    PngWriter trial{*this};
+    trial.mMaximum  = false;
+    trial.mLevel    = 9;
+    trial.mFilter   = filters[i/2];
+    trial.mStrategy = strategies[i%2];
+
+    QBuffer buffer{&trials[static_cast<size_t>(i)]};
+    buffer.open(QIODevice::WriteOnly);
+    trial.write(buffer, img);
+  });
+
+  auto& best = *std::min_element(trials.begin(), trials.end(), [](const QByteArray& a, const QByteArray& b)
+                                 { return a.size() < b.size(); });
+
+  if (dev.write(best) != best.size())
+    throw std::runtime_error{dev.errorString().toStdString()};
+}
+
+
+
+PngStream::PngStream(const PngWriter& writer, QIODevice& dev, int width, int height, QImage::Format format)
+  : mDev{dev},
+    mLevel{writer.mMaximum ? 9 : writer.mLevel},
+    mStrategy{writer.mStrategy},
+    mFilter{writer.mFilter},
+    mWidth{width},
+    mHeight{height},
+    mRows{0},
+    mFormat{format},
+    mPrevRow(static_cast<size_t>(Layout{width, format}.rowBytes), 0),
+    mAdler{adler32(0, nullptr, 0)},
+    mHeaderWritten{false},
+    mDataWritten{false}
+{}
+
+
+
+void PngStream::write(const QImage& strip)
+{
+  assert(strip.width() == mWidth && strip.format() == mFormat);
+  if (mRows + strip.height() > mHeight)
+    throw std::runtime_error{"Too many rows for PNG image"};
+
+  if (!mHeaderWritten)
+    writeHeader(strip);
+
+  Layout layout{mWidth, mFormat};
+  auto img    = layout.convert(strip);
+  auto height = img.height();
+
+  // Filter and deflate strips of the rows in parallel. Each strip uses the
+  // data before it as dictionary, and ends with a sync flush, so that the
+  // strips can simply be concatenated.
+  int stripRows = std::max(1, StripBytes / (layout.rowBytes + 1));
+  int parts     = (height + stripRows - 1) / stripRows;
+  std::vector<QByteArray> rows(static_cast<size_t>(parts));
+
+  parallelFor(parts, [&](int i)
+  { rows[static_cast<size_t>(i)] = filterRows(layout, img, mFilter, i * stripRows, std::min((i + 1) * stripRows, height), mPrevRow); });
+
+  std::vector<QByteArray> dicts(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i)
+  {
+    dicts[i] = (i ? (dicts[i-1] + rows[i-1]).right(WindowBytes) : mWindow);
+    mAdler   = adler32(mAdler, reinterpret_cast<const Bytef*>(rows[i].constData()), static_cast<uInt>(rows[i].size()));
+  }
+
+  std::vector<QByteArray> compressed(rows.size());
+  parallelFor(parts, [&](int i)
+  {
+    auto index = static_cast<size_t>(i);
+    compressed[index] = deflatePart(rows[index], dicts[index], mLevel, mStrategy, false);
+  });
+
+  for (auto& part: compressed)
+    writeData(std::move(part), false);
+
+  if (parts)
+  {
+    mWindow = (dicts.back() + rows.back()).right(WindowBytes);
+    packRow(layout, img, height - 1, mPrevRow.data());
+  }
+
+  mRows += height;
+}
+
+
+
+void PngStream::finish()
+{
+  if (mRows != mHeight)
+    throw std::runtime_error{"Incomplete PNG image"};
+
+  if (!mHeaderWritten)
+    writeHeader(QImage{});
+
+  auto end = deflatePart(QByteArray{}, mWindow, mLevel, mStrategy, true);
+  for (int shift = 24; shift >= 0; shift -= 8)
+    end.append(static_cast<char>((mAdler >> shift) & 0xff));
+
+  writeData(std::move(end), true);
+  writeChunk(mDev, "IEND", QByteArray{});
+}
+
+
+
+/// Writes the chunks before the image data. The resolution is taken from
+/// the first \a strip.
+void PngStream::writeHeader(const QImage& strip)
+{
+  Layout layout{mWidth, mFormat};
+
+  if (mDev.write("\x89PNG\r\n\x1a\n", 8) != 8)
+    throw std::runtime_error{mDev.errorString().toStdString()};
+
+  QByteArray ihdr;
+  appendUint32(ihdr, static_cast<quint32>(mWidth));
+  appendUint32(ihdr, static_cast<quint32>(mHeight));
+  ihdr.append(static_cast<char>(8));                // bit depth
+  ihdr.append(static_cast<char>(layout.colorType));
+  ihdr.append(3, '\0');                             // compression, filter, interlace
+  writeChunk(mDev, "IHDR", ihdr);
+
+  if (strip.dotsPerMeterX() > 0 && strip.dotsPerMeterY() > 0)
+  {
+    QByteArray phys;
+    appendUint32(phys, static_cast<quint32>(strip.dotsPerMeterX()));
+    appendUint32(phys, static_cast<quint32>(strip.dotsPerMeterY()));
+    phys.append(static_cast<char>(1));              // unit is meter
+    writeChunk(mDev, "pHYs", phys);
+  }
+
+  mHeaderWritten = true;
+}
+
+
+
+/// Writes a part of the zlib stream as IDAT chunk. The zlib header is put in
+/// front of the first part.
+void PngStream::writeData(QByteArray data, bool last)
+{
+  if (!mDataWritten)
+  {
+    // See RFC 1950
+    int flevel = (mLevel < 2 ? 0 : mLevel < 6 ? 1 : mLevel == 6 ? 2 : 3);
+    int cmf    = 0x78;
+    int flg    = flevel << 6;
+    flg += 31 - (cmf * 256 + flg) % 31;
+
+    data.prepend(static_cast<char>(flg)).prepend(static_cast<char>(cmf));
+    mDataWritten = true;
+  }
+
+  if (!data.isEmpty() || last)
+    writeChunk(mDev, "IDAT", data);
+}
@@ -0,0 +1,113 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "common.h"
+#include <vector>
+#include <QByteArray>
+#include <QImage>
+class QIODevice;
+
+
+
+/// Writes QImages as PNG files. Unlike QImageWriter, it lets the caller choose
+/// the compression level and row filter, and deflates large images in strips
+/// on all threads. The strips are stitched into a single zlib stream, so the
+/// result is an ordinary PNG file.
+///
+/// Grayscale images are written as 8 bit gray, images with alpha channel as
+/// 8 bit RGBA, and all others as 8 bit RGB, like QImageWriter does.
+///
+class PngWriter
+{
+  public:
+    /// The filter applied to each row before compression. Adaptive chooses
+    /// the best of the others for each row, which is what libpng does.
+    enum class Filter
+    { None, Sub, Up, Average, Paeth, Adaptive };
+
+    PngWriter() noexcept;
+
+    /// Sets the zlib compression \a level, from 0 (none) to 9 (best). The
+    /// default is 6.
+    void setCompression(int level);
+
+    /// Sets the row \a filter. The default is Filter::Adaptive.
+    void setFilter(Filter filter) noexcept;
+
+    /// Enables the maximum compression mode. It tries all filters and several
+    /// zlib strategies at level 9, and keeps the smallest result. This is
+    /// slow, and meant for images that are written once and read often.
+    /// When writing through a PngStream, it just selects level 9.
+    void setMaximumCompression(bool enable) noexcept;
+
+    /// Whether the maximum compression mode is enabled.
+    bool maximumCompression() const noexcept
+    { return mMaximum; }
+
+    /// Writes \a img as PNG file to \a dev. Throws std::runtime_error if
+    /// that fails.
+    void write(QIODevice& dev, const QImage& img) const;
+
+  private:
+    friend class PngStream;
+
+    int mLevel;
+    int mStrategy;
+    Filter mFilter;
+    bool mMaximum;
+};
+
+
+
+/// Writes a PNG file row by row, so that the whole image never has to be in
+/// memory. The rows are passed in consecutive strips to write(), which
+/// compresses each strip in parallel and writes it out immediately.
+///
+class PngStream
+{
+  public:
+    /// Starts a PNG file of \a width x \a height pixels on \a dev, with the
+    /// settings of \a writer. All strips have the given \a format.
+    PngStream(const PngWriter& writer, QIODevice& dev, int width, int height, QImage::Format format);
+
+    /// Writes the next rows of the image, which are the rows of \a strip.
+    /// Throws std::runtime_error if that fails.
+    void write(const QImage& strip);
+
+    /// Completes the PNG file after all rows have been written. Throws
+    /// std::runtime_error if that fails.
+    void finish();
+
+  private:
+    void writeHeader(const QImage& strip);
+    void writeData(QByteArray data, bool last);
+
+    QIODevice& mDev;
+    int mLevel;
+    int mStrategy;
+    PngWriter::Filter mFilter;
+    int mWidth;
+    int mHeight;
+    int mRows;
+    QImage::Format mFormat;
+    std::vector<uchar> mPrevRow;
+    QByteArray mWindow;
+    unsigned long mAdler;
+    bool mHeaderWritten;
+    bool mDataWritten;
+};
@@ -0,0 +1,122 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "rawwriter.h"
+#include <stdexcept>
+#include <QByteArray>
+#include <QIODevice>
+
+
+
+QImage::Format RawStream::imageFormat(Header header, bool alpha, bool gray) noexcept
+{
+  if (header == Header::Ppm)
+    return QImage::Format_RGB888;
+
+  if (gray)
+    return QImage::Format_Grayscale8;
+
+  if (alpha)
+    return QImage::Format_RGBA8888;
+
+  return (header == Header::Pam ? QImage::Format_RGB888 : QImage::Format_RGBX8888);
+}
+
+
+
+RawStream::RawStream(QIODevice& dev, Header header, int width, int height, QImage::Format format)
+  : mDev{dev},
+    mHeader{header},
+    mWidth{width},
+    mHeight{height},
+    mRows{0},
+    mFormat{format},
+    mHeaderWritten{false}
+{
+  assert(format == imageFormat(header, true, false) || format == imageFormat(header, false, true)
+         || format == imageFormat(header, false, false));
+}
+
+
+
+void RawStream::write(const QImage& strip)
+{
+  assert(strip.width() == mWidth && strip.format() == mFormat);
+  if (mRows + strip.height() > mHeight)
+    throw std::runtime_error{"Too many rows for raw image"};
+
+  if (!mHeaderWritten)
+    writeHeader();
+
+  // Scanlines are padded to multiples of 4 bytes, so the strip can only be
+  // written at once if the rows happen to have no padding
+  auto rowBytes = static_cast<qint64>(mWidth) * strip.depth() / 8;
+  if (strip.bytesPerLine() == rowBytes)
+    writeBytes(reinterpret_cast<const char*>(strip.constBits()), rowBytes * strip.height());
+  else
+    for (int y = 0; y < strip.height(); ++y)
+      writeBytes(reinterpret_cast<const char*>(strip.constScanLine(y)), rowBytes);
+
+  mRows += strip.height();
+}
+
+
+
+void RawStream::finish()
+{
+  if (mRows != mHeight)
+    throw std::runtime_error{"Incomplete raw image"};
+
+  if (!mHeaderWritten)
+    writeHeader();
+}
+
+
+
+void RawStream::writeHeader()
+{
+  QByteArray header;
+  switch (mHeader)
+  {
+    case Header::None:
+      break;
+
+    case Header::Pam:
+    {
+      auto depth = QImage::toPixelFormat(mFormat).bitsPerPixel() / 8;
+      auto type  = (depth == 1 ? "GRAYSCALE" : (depth == 3 ? "RGB" : "RGB_ALPHA"));
+      header = "P7\nWIDTH " + QByteArray::number(mWidth) + "\nHEIGHT " + QByteArray::number(mHeight)
+               + "\nDEPTH " + QByteArray::number(depth) + "\nMAXVAL 255\nTUPLTYPE " + type + "\nENDHDR\n";
+      break;
+    }
+
+    case Header::Ppm:
+      header = "P6\n" + QByteArray::number(mWidth) + " " + QByteArray::number(mHeight) + "\n255\n";
+      break;
+  }
+
+  writeBytes(header.constData(), header.size());
+  mHeaderWritten = true;
+}
+
+
+
+void RawStream::writeBytes(const char* data, qint64 size)
+{
+  if (size && mDev.write(data, size) != size)
+    throw std::runtime_error{mDev.errorString().toStdString()};
+}
@@ -0,0 +1,67 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "common.h"
+#include <QImage>
+class QIODevice;
+
+
+
+/// Writes images as uncompressed pixels, for tools that decode or composite
+/// them anyway. The rows are passed in consecutive strips like to PngStream,
+/// and written straight from the image buffers. Therefore the strips must
+/// already have the layout of the file, as returned by imageFormat().
+///
+class RawStream
+{
+  public:
+    /// The header in front of the pixels. Pam is the Netpbm format with
+    /// arbitrary channels, Ppm has RGB pixels, and None just writes the pixels.
+    enum class Header
+    { None, Pam, Ppm };
+
+    /// The image format for strips with the given \a header. Pam and None
+    /// files have 8 bit gray pixels if \a gray is set, RGBA pixels if \a alpha
+    /// is set, and RGB (Pam) or RGBA with opaque alpha (None) pixels otherwise.
+    /// Ppm files always have RGB pixels.
+    static QImage::Format imageFormat(Header header, bool alpha, bool gray) noexcept;
+
+    /// Starts a file of \a width x \a height pixels on \a dev. All strips have
+    /// the given \a format.
+    RawStream(QIODevice& dev, Header header, int width, int height, QImage::Format format);
+
+    /// Writes the next rows of the image, which are the rows of \a strip.
+    /// Throws std::runtime_error if that fails.
+    void write(const QImage& strip);
+
+    /// Completes the file after all rows have been written. Throws
+    /// std::runtime_error if that fails.
+    void finish();
+
+  private:
+    void writeHeader();
+    void writeBytes(const char* data, qint64 size);
+
+    QIODevice& mDev;
+    Header mHeader;
+    int mWidth;
+    int mHeight;
+    int mRows;
+    QImage::Format mFormat;
+    bool mHeaderWritten;
+};
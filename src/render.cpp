@@ -17,10 +17,19 @@
 */
 #include "render.h"
 #include "blur.h"
+#include "displaylist.h"
+#include "parallel.h"
 #include "textimage.h"
+#include <algorithm>
 #include <cmath>
+#include <numeric>
+#include <QCache>
+#include <QDataStream>
+#include <QHash>
 #include <QImage>
+#include <QMutex>
 #include <QPainter>
+#include <QtMath>
 
 
 
@@ -48,7 +57,9 @@ Render::Render(const TextImage& txt, const Graph& graph, const Shapes& shapes, c
     mParagraphs{paragraphs},
     mBrush{Qt::black},
     mShadowMode{Shadow::None},
-    mAntialias{true}
+    mShadowBlur{BlurMethod::Boxes},
+    mAntialias{true},
+    mShadowDelta{DefaultShadowSize}
 {
   computeRenderParams();
 }
@@ -75,16 +86,36 @@ void Render::setLineWidth(float lineWd)
   mDoubleInnerPen = QPen{Qt::white, static_cast<qreal>(lineWd), Qt::SolidLine, Qt::FlatCap, Qt::MiterJoin};
   mDashedPen      = QPen{Qt::black, static_cast<qreal>(lineWd), Qt::CustomDashLine, Qt::FlatCap, Qt::MiterJoin};
   mDashedPen.setDashPattern({5, 3});
+  computeBoundingBox();
+  computeMarkSprites();
 }
 
 
 
 void Render::setShadows(Shadow mode)
-{ mShadowMode = mode; }
+{
+  mShadowMode = mode;
+  computeBoundingBox();
+}
+
+
+/// Sets the offset of shadows from their shapes, which is also the radius of
+/// blurred shadows, and how they are blurred. The drawing is enlarged so that
+/// the shadows fit in completely, unless they reach no further than default
+/// shadows; see computeBoundingBox().
+void Render::setShadowSize(int size, BlurMethod method)
+{
+  mShadowDelta = size;
+  mShadowBlur  = method;
+  computeRenderParams();
+}
 
 
 void Render::setAntialias(bool enable)
-{ mAntialias = enable; }
+{
+  mAntialias = enable;
+  computeMarkSprites();
+}
 
 
 
@@ -95,16 +126,8 @@ void Render::computeRenderParams()
   mScaleY = 0.5 * fm.height();
   mRadius = (mScaleX + mScaleY) * 0.333333;
   mCircle = qRound((mScaleX + mScaleY) * 0.2);
-  mShadowDelta = 2;
 
-  // Determine size and position of the output
-  mBoundingBox = QRect{graphToImage({mGraph.left(), mGraph.top()}), graphToImage({mGraph.right(), mGraph.bottom()})};
-  for (auto& para: mParagraphs)
-    mBoundingBox = mBoundingBox.united(textToImage(para));
-
-  int ltExtend = qRound((mScaleX + mScaleY) * 0.5);
-  int rbExtend = ltExtend + (mShadowMode == Shadow::None ? 0 : mShadowDelta);
-  mBoundingBox.adjust(-ltExtend, -ltExtend, rbExtend, rbExtend);
+  computeBoundingBox();
 
   // Predraw the arrow marks
   auto& arrow = mMarks[Node::RightArrow];
@@ -131,6 +154,113 @@ void Render::computeRenderParams()
   mLeapfrog.lineTo(0, -mRadius);
   mLeapfrog.arcTo(-leapR, -mRadius, 2*leapR, 2*mRadius, 90, -180);
   mLeapfrog.lineTo(0, qRound(mScaleY));
+
+  // Prepare the shapes and their colors
+  mOuterShapes = shapePaths(mShapes.outer, mShadowDelta);
+  mInnerShapes = shapePaths(mShapes.inner, 0);
+  applyHints(Qt::white);
+
+  // The same marks as paths, for drawing them in vector output
+  for (int mark = Node::EmptyCircle; mark <= Node::Leapfrog; ++mark)
+  {
+    auto& glyph = mGlyphs[mark];
+    glyph = QPainterPath{};
+
+    switch (mark)
+    {
+      case Node::EmptyCircle:
+      case Node::FilledCircle:
+        glyph.addEllipse(QPointF{}, mCircle, mCircle);
+        break;
+
+      case Node::Leapfrog:
+        glyph = mLeapfrog;
+        break;
+
+      default:
+        glyph.addPolygon(mMarks[mark]);
+        glyph.closeSubpath();
+        break;
+    }
+  }
+
+  computeMarkSprites();
+}
+
+
+
+/// Determines size and position of the output: the drawing plus a margin of
+/// about a character, which is widened for the shadows if needed.
+void Render::computeBoundingBox()
+{
+  mBoundingBox = QRect{graphToImage({mGraph.left(), mGraph.top()}), graphToImage({mGraph.right(), mGraph.bottom()})};
+  for (auto& para: mParagraphs)
+    mBoundingBox = mBoundingBox.united(textToImage(para));
+
+  int ltExtend = qRound((mScaleX + mScaleY) * 0.5);
+  int rbExtend = ltExtend;
+  if (mShadowMode != Shadow::None)
+  {
+    // Shadows are offset to the bottom right, and blurred ones spread in
+    // all directions
+    bool blurred = (mShadowMode == Shadow::Blurred);
+    int  reach   = mShadowDelta + (blurred ? blurExtent(mShadowDelta, mShadowBlur) : 0);
+
+    // Shadows that reach no further than default ones at scale 1 keep the
+    // usual margin, so that the size of existing drawings does not change.
+    // It may cut off their faint outer edge at the right and bottom.
+    if (reach > DefaultShadowSize + (blurred ? blurExtent(DefaultShadowSize) : 0))
+    {
+      int spread = qCeil(mSolidPen.widthF() / 2) + 1 + reach - mShadowDelta;
+      ltExtend = std::max(ltExtend, spread - mShadowDelta);
+      rbExtend = std::max(rbExtend, spread + mShadowDelta);
+    }
+  }
+
+  mBoundingBox.adjust(-ltExtend, -ltExtend, rbExtend, rbExtend);
+}
+
+
+
+/// Renders every kind of mark once into the mark atlas, which is used for
+/// stamping marks onto bitmaps. The atlas depends on the scale, the line width
+/// and anti-aliasing; each sprite contains the same fractional offset that
+/// paint() applies to the painter, so it can be drawn at integer positions.
+///
+void Render::computeMarkSprites()
+{
+  auto margin  = mSolidPen.widthF() / 2 + 2;
+  auto frac    = (mSolidPen.width() & 1) ? 0.5 : 0.0;
+  int  atlasWd = 0;
+  int  atlasHt = 0;
+
+  for (int mark = Node::EmptyCircle; mark <= Node::Leapfrog; ++mark)
+  {
+    auto bounds = mGlyphs[mark].controlPointRect();
+    auto cell   = bounds.adjusted(-margin, -margin, margin + frac, margin + frac).toAlignedRect();
+
+    auto& sprite  = mMarkSprites[mark];
+    sprite.rect   = QRect{QPoint{atlasWd, 0}, cell.size()};
+    sprite.offset = QPointF(cell.topLeft()) - QPointF{frac, frac};
+
+    atlasWd += cell.width();
+    atlasHt  = std::max(atlasHt, cell.height());
+  }
+
+  mMarkAtlas = QImage{atlasWd, atlasHt, QImage::Format_ARGB32_Premultiplied};
+  mMarkAtlas.fill(Qt::transparent);
+
+  QPainter painter{&mMarkAtlas};
+  if (mAntialias)
+    painter.setRenderHints(QPainter::Antialiasing|QPainter::HighQualityAntialiasing);
+
+  for (int mark = Node::EmptyCircle; mark <= Node::Leapfrog; ++mark)
+  {
+    auto& sprite = mMarkSprites[mark];
+    painter.resetTransform();
+    painter.translate(QPointF(sprite.rect.topLeft()) - sprite.offset);
+    drawMark(painter, static_cast<Node::Mark>(mark));
+  }
 }
 
 
@@ -143,35 +273,115 @@ QSize Render::size() const noexcept
 
 
 
-void Render::paint(QPaintDevice* dev)
+bool Render::isGrayscale() const
 {
-  mOuterShapes = shapePaths(mShapes.outer, mShadowDelta);
-  mInnerShapes = shapePaths(mShapes.inner, 0);
-  applyHints(Qt::white);
+  auto isGray = [](const QColor& color)
+  { return !color.isValid() || (color.red() == color.green() && color.green() == color.blue()); };
+
+  return std::all_of(mInnerShapes.begin(), mInnerShapes.end(), [&](const ShapePath& shape)
+                     { return isGray(shape.color); });
+}
+
+
+
+void Render::paint(QPaintDevice* dev) const
+{
+  QPainter painter{dev};
+  paint(painter, displayList());
+}
+
+
+
+void Render::paint(QPainter& painter, const DisplayList& list) const
+{
+  painter.save();
+  preparePainter(painter);
+  list.replay(painter);
+  painter.restore();
+}
+
+
+
+namespace {
+constexpr int MinTileHeight  = 64;
+constexpr int MinTiledPixels = 1024 * 1024;
+} // namespace
 
-  QImage shadowImg;
-  if (mShadowMode == Shadow::Blurred)
+
+
+void Render::paintTiled(QImage& img) const
+{
+  assert(img.size() == size());
+  paintTiled(img, displayList(), 0);
+}
+
+
+
+void Render::paintTiled(QImage& strip, const DisplayList& list, int top) const
+{
+  assert(strip.width() == size().width());
+
+  auto width  = strip.width();
+  auto height = strip.height();
+  auto tiles  = std::min(parallelism() * 2, height / MinTileHeight);
+
+  // A single thread gains nothing from tiles, but replays the list for each
+  if (tiles <= 1 || parallelism() == 1 || width * height < MinTiledPixels)
+    tiles = 1;
+
+  // Each tile is a QImage on the memory of a horizontal band of the strip.
+  // Since tiles are only translated by whole pixels, they do not show any
+  // seams. Each tile only draws the parts of merged paths near it.
+  auto bits = strip.bits();
+  auto bpl  = strip.bytesPerLine();
+
+  parallelFor(tiles, [&](int i)
   {
-    shadowImg = QImage{size(), QImage::Format_Alpha8};
-    shadowImg.fill(Qt::transparent);
-    mPainter.begin(&shadowImg);
-    drawShapes(mOuterShapes, Qt::black);
-    mPainter.end();
-  }
+    int begin = height * i / tiles;
+    int end   = height * (i + 1) / tiles;
 
-  mPainter.begin(dev);
-  mPainter.setRenderHint(QPainter::SmoothPixmapTransform);
-  mPainter.setFont(mFont);
-  mPainter.translate(-mBoundingBox.topLeft());
+    QImage tile{bits + begin * bpl, width, end - begin, bpl, strip.format()};
+    QPainter painter{&tile};
+    painter.translate(0, -(top + begin));
+    preparePainter(painter);
+
+    auto region = painter.transform().inverted().mapRect(QRectF{tile.rect()});
+    list.replay(painter, region);
+  });
+}
+
+
+
+QPointF Render::origin() const noexcept
+{
+  // Odd line widths are centered on the pixels
+  QPointF result = -mBoundingBox.topLeft();
+  if (mSolidPen.width() & 1)
+    result += QPointF{0.5, 0.5};
+
+  return result;
+}
+
+
+
+void Render::preparePainter(QPainter& painter) const
+{
+  painter.setRenderHint(QPainter::SmoothPixmapTransform);
+  painter.translate(origin());
 
   if (mAntialias)
   {
-    mPainter.setRenderHints(QPainter::Antialiasing|QPainter::HighQualityAntialiasing);
-    mPainter.setRenderHint(QPainter::TextAntialiasing);
+    painter.setRenderHints(QPainter::Antialiasing|QPainter::HighQualityAntialiasing);
+    painter.setRenderHint(QPainter::TextAntialiasing);
   }
+}
 
-  if (mSolidPen.width() & 1)
-    mPainter.translate(0.5, 0.5);
+
+
+DisplayList Render::displayList() const
+{
+  DisplayList list;
+  list.setFont(mFont);
 
   switch (mShadowMode)
   {
@@ -179,21 +389,222 @@ void Render::paint(QPaintDevice* dev)
       break;
 
     case Shadow::Simple:
-      drawShapes(mOuterShapes, Qt::lightGray);
+      drawShapes(list, mOuterShapes, Qt::lightGray);
       break;
 
     case Shadow::Blurred:
-      blurImage(shadowImg, mShadowDelta);
-      mPainter.drawImage(0, 0, filledImage(Qt::darkGray, shadowImg));
+      list.setBrush(Qt::darkGray);
+      for (auto& patch: shadowPatches())
+        list.drawMask(patch.pos, patch.mask);
       break;
   }
 
-  drawShapes(mInnerShapes, Qt::white);
-  drawLines();
-  drawMarks();
-  drawParagraphs();
+  drawShapes(list, mInnerShapes, Qt::white);
+  drawLines(list);
+  drawMarks(list);
+  drawParagraphs(list);
+  list.optimize();
+
+  return list;
+}
+
+
+
+namespace {
+/// Merges intersecting \a rects until all of them are disjoint. Each pass
+/// sweeps over the rects sorted by their left edge, so that only those that
+/// overlap horizontally are compared, joins intersecting ones into clusters,
+/// and merges each cluster once. The merged rects may intersect further ones,
+/// so passes are repeated until nothing is merged anymore.
+std::vector<QRect> clustered(std::vector<QRect> rects)
+{
+  for (;;)
+  {
+    std::sort(rects.begin(), rects.end(), [](const QRect& a, const QRect& b) { return a.left() < b.left(); });
+
+    // Union-find of the clusters; the root of a cluster is its first rect
+    std::vector<size_t> parent(rects.size());
+    std::iota(parent.begin(), parent.end(), size_t{0});
+
+    auto root = [&](size_t i)
+    {
+      while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+
+      return i;
+    };
+
+    bool merged = false;
+    for (size_t i = 0; i < rects.size(); ++i)
+      for (size_t j = i + 1; j < rects.size() && rects[j].left() <= rects[i].right(); ++j)
+      {
+        auto a = root(i);
+        auto b = root(j);
+        if (a != b && rects[i].intersects(rects[j]))
+        {
+          parent[std::max(a, b)] = std::min(a, b);
+          merged = true;
+        }
+      }
+
+    if (!merged)
+      return rects;
+
+    std::vector<QRect> clusters;
+    for (size_t i = 0; i < rects.size(); ++i)
+      if (root(i) != i)
+        rects[root(i)] |= rects[i];
+
+    for (size_t i = 0; i < rects.size(); ++i)
+      if (parent[i] == i)
+        clusters.push_back(rects[i]);
+
+    rects = std::move(clusters);
+  }
+}
+} // namespace
+
+
+
+namespace {
+/// The maximum size of the shadow cache, in bytes of mask pixels.
+constexpr int MaxShadowCacheCost = 32 * 1024 * 1024;
+
+/// Shape coordinates in the keys of the shadow cache are rounded to this
+/// fraction of a pixel, so that rounding errors do not prevent the same shape
+/// at different positions from having the same key.
+constexpr double ShadowKeyPrecision = 4096;
+
+
+
+/// Blurred shadow masks by the geometry of their shapes and the parameters
+/// they were rendered with. The cache is shared by all Render objects, so
+/// that identical shapes in all documents of a run are only blurred once.
+struct ShadowCache
+{
+  QMutex mutex;
+  QCache<QByteArray, QImage> masks{MaxShadowCacheCost};
+};
+
+
+
+ShadowCache& shadowCache()
+{
+  static ShadowCache cache;
+  return cache;
+}
+
+
+
+/// Writes the elements of \a path, relative to \a origin, to the shadow
+/// cache key \a out.
+void writeShadowKey(QDataStream& out, const QPainterPath& path, const QPoint& origin)
+{
+  out << static_cast<qint32>(path.elementCount());
+
+  for (int i = 0; i < path.elementCount(); ++i)
+  {
+    auto e = path.elementAt(i);
+    out << static_cast<quint8>(e.type)
+        << static_cast<qint32>(qRound((e.x - origin.x()) * ShadowKeyPrecision))
+        << static_cast<qint32>(qRound((e.y - origin.y()) * ShadowKeyPrecision));
+  }
+}
+} // namespace
+
+
+
+/// The blurred shadows of the outer shapes as alpha masks. Shapes whose
+/// shadows are near each other are grouped into one patch, and each patch
+/// is just large enough that blurring it gives the same result as blurring
+/// the whole canvas. Patches with the same shapes share their mask, which
+/// is also kept in a cache for the next call.
+auto Render::shadowPatches() const -> std::vector<ShadowPatch>
+{
+  // Pixels outside the padded bounds stay transparent through all passes of
+  // the blur. Patches that are further apart do not influence each other.
+  int  pad    = blurExtent(mShadowDelta, mShadowBlur) + 1;
+  auto margin = qCeil(mSolidPen.widthF() / 2) + 1 + pad;
+
+  std::vector<QRect> rects;
+  for (auto& shape: mOuterShapes)
+    rects.push_back(shape.path.controlPointRect().toAlignedRect().adjusted(-margin, -margin, margin, margin));
+
+  rects = clustered(std::move(rects));
+
+  // Clip to the area that a full-canvas shadow mask covers
+  QRect canvas{QPoint{}, size()};
+  for (auto& rect: rects)
+    rect &= canvas;
+
+  rects.erase(std::remove_if(rects.begin(), rects.end(), [](const QRect& r) { return r.isEmpty(); }), rects.end());
+
+  // The key of a patch is the geometry of its shapes relative to it, plus
+  // all parameters that change the mask
+  std::vector<QByteArray> keys(rects.size());
+  for (size_t i = 0; i < rects.size(); ++i)
+  {
+    QDataStream out{&keys[i], QIODevice::WriteOnly};
+    out << rects[i].size() << static_cast<qint32>(mShadowDelta) << static_cast<qint32>(mShadowBlur) << mSolidPen.widthF();
+
+    for (auto& shape: mOuterShapes)
+      if (rects[i].intersects(shape.path.controlPointRect().toAlignedRect()))
+        writeShadowKey(out, shape.path, rects[i].topLeft());
+  }
+
+  // Take the masks from the cache where possible, and find the distinct
+  // masks that have to be rendered
+  std::vector<ShadowPatch> patches(rects.size());
+  QHash<QByteArray, size_t> rendered;
+  std::vector<size_t> missing;
+
+  auto& cache = shadowCache();
+  {
+    QMutexLocker lock{&cache.mutex};
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+      patches[i].pos = rects[i].topLeft();
+
+      if (auto mask = cache.masks.object(keys[i]))
+        patches[i].mask = *mask;
+      else if (!rendered.contains(keys[i]))
+      {
+        rendered.insert(keys[i], i);
+        missing.push_back(i);
+      }
+    }
+  }
+
+  DisplayList list;
+  drawShapes(list, mOuterShapes, Qt::black);
+
+  parallelFor(static_cast<int>(missing.size()), [&](int i)
+  {
+    auto  index = missing[static_cast<size_t>(i)];
+    auto& patch = patches[index];
+    patch.mask  = QImage{rects[index].size(), QImage::Format_Alpha8};
+
+    patch.mask.fill(Qt::transparent);
+    QPainter painter{&patch.mask};
+    painter.translate(-patch.pos);
+    list.replay(painter, QRectF{QRect{patch.pos, patch.mask.size()}});
+    painter.end();
+
+    blurImage(patch.mask, mShadowDelta, mShadowBlur);
+  });
+
+  for (size_t i = 0; i < patches.size(); ++i)
+    if (patches[i].mask.isNull())
+      patches[i].mask = patches[rendered.value(keys[i])].mask;
 
-  mPainter.end();
+  QMutexLocker lock{&cache.mutex};
+  for (auto i: missing)
+  {
+    auto& mask = patches[i].mask;
+    cache.masks.insert(keys[i], new QImage{mask}, mask.bytesPerLine() * mask.height());
+  }
+
+  return patches;
 }
 
 
@@ -233,21 +644,27 @@ void Render::applyHints(const QColor& defaultColor)
   }
 
   mInnerShapes.reverse();
+  mTextColors.assign(mParagraphs.size(), QColor{});
 
   for (const auto& shape: mInnerShapes)
   {
     auto color     = shape.color.isValid() ? shape.color : defaultColor;
     bool darkShape = color.lightness() < 100;
+    auto textColor = mTextColors.begin();
 
     for (auto& para: mParagraphs)
+    {
       if (shape.path.contains(textToImage(para.topInnerX(), para.top())))
-        para.color = darkShape ? Qt::white : Qt::black;
+        *textColor = darkShape ? Qt::white : Qt::black;
+
+      ++textColor;
+    }
   }
 }
 
 
 
-void Render::drawShapes(const ShapePaths& shapes, const QColor& defaultColor)
+void Render::drawShapes(DisplayList& list, const ShapePaths& shapes, const QColor& defaultColor) const
 {
   QPen pen{mSolidPen};
 
@@ -255,17 +672,19 @@ void Render::drawShapes(const ShapePaths& shapes, const QColor& defaultColor)
   {
     auto color = shape.color.isValid() ? shape.color : defaultColor;
     pen.setColor(color);
-    mPainter.setPen(pen);
-    mPainter.setBrush(color);
-    mPainter.drawPath(shape.path);
+    list.setPen(pen);
+    list.setBrush(color);
+    list.drawPath(shape.path);
   }
 }
 
 
 
-void Render::drawLines()
+/// Records all lines one by one; DisplayList::optimize() joins the lines of
+/// the same style into one path later on.
+void Render::drawLines(DisplayList& list) const
 {
-  mPainter.setBrush(Qt::NoBrush);
+  list.setBrush(Qt::NoBrush);
   for (auto& line: mShapes.lines)
   {
     switch (line.style())
@@ -275,24 +694,24 @@ void Render::drawLines()
 
       case Edge::Weak:
       case Edge::Solid:
-        mPainter.setPen(mSolidPen);
+        list.setPen(mSolidPen);
         break;
 
       case Edge::Dashed:
-        mPainter.setPen(mDashedPen);
+        list.setPen(mDashedPen);
         break;
 
       case Edge::Double:
-        mPainter.setPen(mDoubleOuterPen);
-        mPainter.drawPath(line.path(mScaleX, mScaleY, mRadius));
-        mPainter.setPen(mDoubleInnerPen);
+        list.setPen(mDoubleOuterPen);
+        list.drawPath(line.path(mScaleX, mScaleY, mRadius));
+        list.setPen(mDoubleInnerPen);
         break;
 
       case Edge::Invisible:
         continue;
     }
 
-    mPainter.drawPath(line.path(mScaleX, mScaleY, mRadius));
+    list.drawPath(line.path(mScaleX, mScaleY, mRadius));
   }
 }
 
@@ -303,42 +722,87 @@ inline QPoint Render::graphToImage(Point p) const noexcept
 
 
 
-void Render::drawMarks()
+/// Records the marks of the same kind as one command, so that the painter
+/// state changes only once per kind.
+void Render::drawMarks(DisplayList& list) const
 {
+  QVector<QPoint> positions[Node::Leapfrog + 1];
   for (auto& node: mGraph)
+    if (node.mark() != Node::NoMark)
+      positions[node.mark()].append(graphToImage(node.point()));
+
+  for (int mark = Node::EmptyCircle; mark <= Node::Leapfrog; ++mark)
   {
-    switch (node.mark())
-    {
-      case Node::NoMark:
-        continue;
+    if (positions[mark].isEmpty())
+      continue;
 
-      case Node::RightArrow:
-      case Node::UpArrow:
-      case Node::LeftArrow:
-      case Node::DownArrow:
-        mPainter.setPen(Qt::NoPen);
-        mPainter.setBrush(mBrush);
-        mPainter.drawPolygon(mMarks[node.mark()].translated(graphToImage(node.point())));
-        break;
+    auto& sprite = mMarkSprites[mark];
+    list.setPen(markPen(static_cast<Node::Mark>(mark)));
+    list.setBrush(markBrush(static_cast<Node::Mark>(mark)));
+    list.drawStamps(mGlyphs[mark], std::move(positions[mark]), mMarkAtlas, sprite.rect, sprite.offset);
+  }
+}
 
-      case Node::EmptyCircle:
-        mPainter.setPen(mSolidPen);
-        mPainter.setBrush(Qt::white);
-        mPainter.drawEllipse(graphToImage(node.point()), mCircle, mCircle);
-        break;
 
-      case Node::FilledCircle:
-        mPainter.setPen(Qt::NoPen);
-        mPainter.setBrush(mBrush);
-        mPainter.drawEllipse(graphToImage(node.point()), mCircle, mCircle);
-        break;
 
-      case Node::Leapfrog:
-        mPainter.setPen(mSolidPen);
-        mPainter.setBrush(Qt::NoBrush);
-        mPainter.drawPath(mLeapfrog.translated(graphToImage(node.point())));
-        break;
-    }
+QPen Render::markPen(Node::Mark mark) const
+{
+  switch (mark)
+  {
+    case Node::EmptyCircle:
+    case Node::Leapfrog:
+      return mSolidPen;
+
+    default:
+      return Qt::NoPen;
+  }
+}
+
+
+
+QBrush Render::markBrush(Node::Mark mark) const
+{
+  switch (mark)
+  {
+    case Node::EmptyCircle:
+      return Qt::white;
+
+    case Node::Leapfrog:
+      return Qt::NoBrush;
+
+    default:
+      return mBrush;
+  }
+}
+
+
+
+/// Draws a single \a mark at the origin of the \a painter.
+void Render::drawMark(QPainter& painter, Node::Mark mark) const
+{
+  painter.setPen(markPen(mark));
+  painter.setBrush(markBrush(mark));
+
+  switch (mark)
+  {
+    case Node::NoMark:
+      break;
+
+    case Node::RightArrow:
+    case Node::UpArrow:
+    case Node::LeftArrow:
+    case Node::DownArrow:
+      painter.drawPolygon(mMarks[mark]);
+      break;
+
+    case Node::EmptyCircle:
+    case Node::FilledCircle:
+      painter.drawEllipse(QPoint{}, mCircle, mCircle);
+      break;
+
+    case Node::Leapfrog:
+      painter.drawPath(mLeapfrog);
+      break;
   }
 }
 
@@ -364,15 +828,16 @@ inline QRect Render::textToImage(const Paragraph& p) const noexcept
 
 
 
-void Render::drawParagraphs()
+void Render::drawParagraphs(DisplayList& list) const
 {
-  QFontMetrics fm{mFont};
+  auto textColor = mTextColors.begin();
   for (auto& para: mParagraphs)
   {
     auto align = para.alignment();
     auto rect  = textToImage(para);
+    auto color = *textColor++;
 
-    mPainter.setPen(para.color.isValid() ? para.color : Qt::black);
+    list.setPen(color.isValid() ? color : Qt::black);
     for (int rowIdx = 0; rowIdx < para.height(); ++rowIdx)
     {
       auto& rowTxt = para[rowIdx];
@@ -382,7 +847,7 @@ void Render::drawParagraphs()
         lrect.adjust(qRound(para.indent(rowIdx) * 2 * mScaleX), 0, 0, 0);
 
       auto rowStr = QString::fromWCharArray(rowTxt.data(), static_cast<int>(rowTxt.size()));
-      mPainter.drawText(lrect, static_cast<int>(align), rowStr);
+      list.drawText(lrect, static_cast<int>(align), rowStr);
     }
   }
 }
@@ -16,11 +16,15 @@
     along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
 */
 #pragma once
+#include "blur.h"
 #include "graph.h"
 #include "hints.h"
 #include "shapes.h"
 #include "paragraphs.h"
+#include "displaylist.h"
 #include <forward_list>
+#include <vector>
+#include <QImage>
 #include <QPainter>
 class TextImage;
 
@@ -30,6 +34,10 @@ class TextImage;
 enum class Shadow
 { None, Simple, Blurred };
 
+/// The default offset of shadows from their shapes in pixels, which is also
+/// the blur radius of blurred shadows.
+constexpr int DefaultShadowSize = 2;
+
 
 
 /// Embodies a rendering function for rendering a preprocessed ASCII image to a
@@ -42,28 +50,67 @@ class Render
     ~Render();
 
     QSize size() const noexcept;
+
+    /// Whether the drawing only uses shades of gray, i.e. none of its shapes
+    /// were given a color by a hint.
+    bool isGrayscale() const;
+
     void setFont(const QFont& font);
     void setLineWidth(float lineWd);
     void setShadows(Shadow mode);
+    void setShadowSize(int size, BlurMethod method);
     void setAntialias(bool enable);
-    void paint(QPaintDevice* dev);
+
+    /// The offset of the paint device coordinates to those of displayList().
+    QPointF origin() const noexcept;
+
+    /// Records the drawing with the current settings as a display list, for
+    /// painting it to one or more devices.
+    DisplayList displayList() const;
+
+    /// Paints the drawing to \a dev. The function does not modify the Render
+    /// object, so it can be called concurrently for different paint devices.
+    void paint(QPaintDevice* dev) const;
+
+    /// Paints the display \a list, which must have been recorded by
+    /// displayList(), with the active \a painter. Its state is restored
+    /// afterwards, so that several drawings can be painted onto the pages of
+    /// one document.
+    void paint(QPainter& painter, const DisplayList& list) const;
+
+    /// Paints the drawing onto \a img like paint(). Large images are split
+    /// into horizontal tiles, which are painted in parallel.
+    void paintTiled(QImage& img) const;
+
+    /// Paints the rows of the drawing from \a top on onto \a strip, which is
+    /// as wide as the drawing, like paintTiled(). The \a list must have been
+    /// recorded by displayList(). Painting a large image strip by strip
+    /// bounds the memory needed to the size of a strip.
+    void paintTiled(QImage& strip, const DisplayList& list, int top) const;
 
   private:
     struct ShapePath;
+    struct Sprite { QRect rect; QPointF offset; };
+    struct ShadowPatch { QPoint pos; QImage mask; };
     using ShapePaths = std::forward_list<ShapePath>;
 
     void computeRenderParams();
+    void computeBoundingBox();
+    void computeMarkSprites();
+    void preparePainter(QPainter& painter) const;
     QPoint graphToImage(Point p) const noexcept;
     QPoint textToImage(int x, int y) const noexcept;
     QRect textToImage(const Paragraph& p) const noexcept;
     ShapePaths shapePaths(const Shapes::List& shapes, int delta) const;
     void applyHints(const QColor& defaultColor);
-    void drawShapes(const ShapePaths& shapes, const QColor& defaultColor);
-    void drawLines();
-    void drawMarks();
-    void drawRoundCorner(Node node, Point pos);
-    void drawArrow(Point pos);
-    void drawParagraphs();
+    std::vector<ShadowPatch> shadowPatches() const;
+    void drawShapes(DisplayList& list, const ShapePaths& shapes, const QColor& defaultColor) const;
+    void drawLines(DisplayList& list) const;
+    void drawMarks(DisplayList& list) const;
+    QPen markPen(Node::Mark mark) const;
+    QBrush markBrush(Node::Mark mark) const;
+    void drawMark(QPainter& painter, Node::Mark mark) const;
+    void drawParagraphs(DisplayList& list) const;
 
     const TextImage& mTxt;
     const Graph& mGraph;
@@ -76,10 +123,13 @@ class Render
     QPen mDoubleInnerPen;
     QPen mDashedPen;
     QBrush mBrush;
-    QPainter mPainter;
     QPolygonF mMarks[7];
     QPainterPath mLeapfrog;
+    QPainterPath mGlyphs[Node::Leapfrog + 1];
+    QImage mMarkAtlas;
+    Sprite mMarkSprites[Node::Leapfrog + 1];
     Shadow mShadowMode;
+    BlurMethod mShadowBlur;
     bool mAntialias;
 
     double mScaleX;
@@ -91,4 +141,5 @@ class Render
 
     ShapePaths mOuterShapes;
     ShapePaths mInnerShapes;
+    std::vector<QColor> mTextColors;
 };
@@ -0,0 +1,789 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "svgwriter.h"
+#include "blur.h"
+#include "displaylist.h"
+#include "pngwriter.h"
+#include <cstdlib>
+#include <algorithm>
+#include <initializer_list>
+#include <numeric>
+#include <stdexcept>
+#include <zlib.h>
+#include <QBuffer>
+#include <QFontMetricsF>
+#include <QIODevice>
+
+
+
+namespace {
+/// Coordinates are rounded to 1/Precision pixel. appendFixed() relies on
+/// this being 100.
+constexpr qint64 Precision = 100;
+
+/// The document is written to the device in chunks of about this size.
+constexpr int ChunkBytes = 64 * 1024;
+
+/// Subpaths of shapes are only shared if their path data has at least this
+/// size, since a <use> element is not much shorter than a short path.
+constexpr int MinSharedBytes = 32;
+
+
+
+inline qint64 fixed(qreal value) noexcept
+{ return qRound64(value * Precision); }
+
+
+
+/// Appends the fixed point \a value with as few digits as possible.
+void appendFixed(QByteArray& out, qint64 value)
+{
+  if (value < 0)
+  {
+    out += '-';
+    value = -value;
+  }
+
+  out += QByteArray::number(value / Precision);
+
+  auto frac = static_cast<int>(value % Precision);
+  if (frac)
+  {
+    out += '.';
+    out += static_cast<char>('0' + frac / 10);
+
+    if (frac % 10)
+      out += static_cast<char>('0' + frac % 10);
+  }
+}
+
+
+inline void appendNumber(QByteArray& out, qreal value)
+{ appendFixed(out, fixed(value)); }
+
+
+
+/// The shortest hexadecimal notation of \a color, without alpha.
+QByteArray colorName(const QColor& color)
+{
+  const auto name = color.name().toLatin1();
+  if (name.at(1) == name.at(2) && name.at(3) == name.at(4) && name.at(5) == name.at(6))
+    return QByteArray{"#"} + name.at(1) + name.at(3) + name.at(5);
+
+  return name;
+}
+
+
+
+/// Appends the declarations for painting the \a property with \a color.
+void appendPaint(QByteArray& out, const char* property, const QColor& color)
+{
+  out += property;
+  out += ':';
+  out += colorName(color);
+  out += ';';
+
+  if (color.alpha() != 255)
+  {
+    out += property;
+    out += "-opacity:";
+    appendNumber(out, color.alphaF());
+    out += ';';
+  }
+}
+
+
+
+/// The style sheet declarations for drawing a path with \a pen and \a brush,
+/// and filling it with the fill \a rule. Properties that have their initial
+/// value are left out.
+QByteArray shapeStyle(const QPen& pen, const QBrush& brush, Qt::FillRule rule)
+{
+  QByteArray out;
+
+  if (brush.style() == Qt::NoBrush)
+    out += "fill:none;";
+  else
+  {
+    appendPaint(out, "fill", brush.color());
+    if (rule == Qt::OddEvenFill)
+      out += "fill-rule:evenodd;";
+  }
+
+  if (pen.style() == Qt::NoPen)
+    return out + "stroke:none";
+
+  appendPaint(out, "stroke", pen.color());
+
+  // Cosmetic pens are one pixel wide on all devices we write
+  auto width = (pen.widthF() > 0 ? pen.widthF() : 1.0);
+  if (width != 1)
+  {
+    out += "stroke-width:";
+    appendNumber(out, width);
+    out += ';';
+  }
+
+  switch (pen.capStyle())
+  {
+    case Qt::SquareCap: out += "stroke-linecap:square;"; break;
+    case Qt::RoundCap:  out += "stroke-linecap:round;"; break;
+    default:            break;
+  }
+
+  switch (pen.joinStyle())
+  {
+    case Qt::BevelJoin: out += "stroke-linejoin:bevel;"; break;
+    case Qt::RoundJoin: out += "stroke-linejoin:round;"; break;
+    default:
+      if (pen.miterLimit() != 4)
+      {
+        out += "stroke-miterlimit:";
+        appendNumber(out, pen.miterLimit());
+        out += ';';
+      }
+      break;
+  }
+
+  // Qt gives dash patterns in units of the pen width. QtSvg does not read
+  // them from style sheets if they are separated by commas.
+  if (pen.style() != Qt::SolidLine)
+  {
+    out += "stroke-dasharray:";
+    for (auto dash: pen.dashPattern())
+    {
+      appendNumber(out, dash * width);
+      out += ' ';
+    }
+    out.chop(1);
+    out += ';';
+
+    if (pen.dashOffset() != 0)
+    {
+      out += "stroke-dashoffset:";
+      appendNumber(out, pen.dashOffset() * width);
+      out += ';';
+    }
+  }
+
+  out.chop(1);
+  return out;
+}
+
+
+
+/// The style sheet declarations for drawing text with \a pen, aligned
+/// horizontally as given by \a flags.
+QByteArray textStyle(const QPen& pen, int flags)
+{
+  QByteArray out;
+  appendPaint(out, "fill", pen.color());
+
+  if (flags & Qt::AlignHCenter)
+    out += "text-anchor:middle;";
+  else if (flags & Qt::AlignRight)
+    out += "text-anchor:end;";
+
+  out.chop(1);
+  return out;
+}
+
+
+
+/// The CSS font weight closest to the QFont \a weight.
+int cssWeight(int weight) noexcept
+{
+  static const int weights[] = {QFont::Thin, QFont::ExtraLight, QFont::Light, QFont::Normal, QFont::Medium,
+                                QFont::DemiBold, QFont::Bold, QFont::ExtraBold, QFont::Black};
+
+  int best = 0;
+  for (int i = 1; i < 9; ++i)
+    if (std::abs(weights[i] - weight) < std::abs(weights[best] - weight))
+      best = i;
+
+  return (best + 1) * 100;
+}
+
+
+
+/// The anchor of text drawn into \a rect with QPainter::drawText(), on the
+/// baseline of the text.
+QPointF textPosition(const QFontMetricsF& fm, const QRect& rect, int flags)
+{
+  QRectF r{rect};
+
+  auto x = r.left();
+  if (flags & Qt::AlignHCenter)
+    x = r.center().x();
+  else if (flags & Qt::AlignRight)
+    x = r.right();
+
+  auto y = r.top() + fm.ascent();
+  if (flags & Qt::AlignVCenter)
+    y = r.center().y() - fm.height() / 2 + fm.ascent();
+  else if (flags & Qt::AlignBottom)
+    y = r.bottom() - fm.descent();
+
+  return QPointF{x, y};
+}
+
+
+
+/// Appends the path data of the elements [\a begin, \a end) of \a path,
+/// moved by \a dx and \a dy. Only the first point is absolute, the others
+/// are relative to the previous one. Subpaths that end where they started
+/// are closed, because QPainter joins their ends as well.
+void appendPathData(QByteArray& out, const QPainterPath& path, int begin, int end, qint64 dx, qint64 dy)
+{
+  char   cmd   = 0;
+  qint64 x     = 0;
+  qint64 y     = 0;
+  qint64 sx    = 0;
+  qint64 sy    = 0;
+  int    first = begin;
+
+  // Repeated commands are left out, and numbers are separated by a blank
+  // or the sign of a negative number
+  auto append = [&](char c, std::initializer_list<qint64> args)
+  {
+    bool sep = (c == cmd);
+    if (!sep)
+      out += (cmd = c);
+
+    for (auto value: args)
+    {
+      if (sep && value >= 0)
+        out += ' ';
+
+      appendFixed(out, value);
+      sep = true;
+    }
+  };
+
+  auto closes = [&](int i, qint64 ex, qint64 ey)
+  { return ex == sx && ey == sy && i - first >= 2 && (i + 1 == end || path.elementAt(i + 1).isMoveTo()); };
+
+  for (int i = begin; i < end; ++i)
+  {
+    auto& e  = path.elementAt(i);
+    auto  ex = fixed(e.x);
+    auto  ey = fixed(e.y);
+
+    switch (e.type)
+    {
+      case QPainterPath::MoveToElement:
+        if (i == begin)
+          append('M', {ex + dx, ey + dy});
+        else
+        {
+          cmd = 0;
+          append('m', {ex - x, ey - y});
+        }
+
+        // A line after a move would repeat it
+        cmd   = 0;
+        first = i;
+        sx    = ex;
+        sy    = ey;
+        break;
+
+      case QPainterPath::LineToElement:
+        if (closes(i, ex, ey))
+          append('z', {});
+        else if (ey == y)
+          append('h', {ex - x});
+        else if (ex == x)
+          append('v', {ey - y});
+        else
+          append('l', {ex - x, ey - y});
+        break;
+
+      case QPainterPath::CurveToElement: {
+        auto& c2 = path.elementAt(i + 1);
+        auto& pe = path.elementAt(i + 2);
+        auto  px = fixed(pe.x);
+        auto  py = fixed(pe.y);
+
+        append('c', {ex - x, ey - y, fixed(c2.x) - x, fixed(c2.y) - y, px - x, py - y});
+        i += 2;
+        ex = px;
+        ey = py;
+
+        if (closes(i, ex, ey))
+          append('z', {});
+        break;
+      }
+
+      case QPainterPath::CurveToDataElement:
+        assert(false);
+        break;
+    }
+
+    x = ex;
+    y = ey;
+  }
+}
+} // namespace
+
+
+
+/// A subpath of a shape, or an instance of a stamped glyph. If it can be
+/// drawn on its own, it may reference a definition of its geometry.
+struct SvgWriter::Piece
+{
+  int begin;           // the elements of the path
+  int end;
+  qint64 dx;           // by which the elements are moved
+  qint64 dy;
+  QByteArray geometry; // path data relative to the first point; empty if
+                       // the piece must be drawn together with the others
+};
+
+
+
+/// Compresses the document in gzip format while it is written.
+struct SvgWriter::Deflater
+{
+  Deflater();
+  ~Deflater();
+  QByteArray deflateChunk(const QByteArray& data, bool last);
+
+  z_stream zs;
+};
+
+
+
+SvgWriter::Deflater::Deflater()
+  : zs{}
+{
+  // Adding 16 to the window bits selects the gzip format
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw std::runtime_error{"Failed to initialize zlib"};
+}
+
+
+SvgWriter::Deflater::~Deflater()
+{ deflateEnd(&zs); }
+
+
+
+/// Compresses the next chunk of \a data. The \a last chunk completes the
+/// gzip stream.
+QByteArray SvgWriter::Deflater::deflateChunk(const QByteArray& data, bool last)
+{
+  QByteArray result;
+  char buffer[16 * 1024];
+
+  zs.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+  zs.avail_in = static_cast<uInt>(data.size());
+
+  int ret;
+  do
+  {
+    zs.next_out  = reinterpret_cast<Bytef*>(buffer);
+    zs.avail_out = sizeof(buffer);
+
+    ret = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_ERROR)
+      throw std::runtime_error{"Failed to compress SVG document"};
+
+    result.append(buffer, static_cast<int>(sizeof(buffer) - zs.avail_out));
+  }
+  while (last ? ret != Z_STREAM_END : zs.avail_out == 0);
+
+  return result;
+}
+
+
+
+SvgWriter::SvgWriter(QIODevice& dev)
+  : mDev{dev},
+    mCompressed{false}
+{}
+
+
+SvgWriter::~SvgWriter()
+= default;
+
+
+
+void SvgWriter::setCompressed(bool enable) noexcept
+{ mCompressed = enable; }
+
+
+
+void SvgWriter::write(const DisplayList& list, const QSize& size, const QPointF& origin)
+{
+  using Command = DisplayList::Command;
+
+  // The style sheet and the definitions must come before the first element
+  // that uses them
+  mClasses.clear();
+  mUses.clear();
+  mGeometries.clear();
+
+  if (mCompressed)
+    mDeflater = std::make_unique<Deflater>();
+
+  std::vector<int> classes;
+  std::vector<Pieces> pieces(list.size());
+  classes.reserve(list.size());
+
+  auto piece = pieces.begin();
+  for (auto& cmd: list)
+  {
+    switch (cmd.kind)
+    {
+      case Command::Path:
+        classes.push_back(styleClass(shapeStyle(cmd.pen, cmd.brush, cmd.path.fillRule())));
+        *piece = shapePieces(cmd.path, cmd.pen, cmd.brush);
+        break;
+
+      case Command::Stamps:
+        classes.push_back(styleClass(shapeStyle(cmd.pen, cmd.brush, Qt::WindingFill)));
+        *piece = stampPieces(cmd.path, cmd.positions);
+        break;
+
+      case Command::Text:
+        classes.push_back(styleClass(textStyle(cmd.pen, cmd.flags)));
+        break;
+
+      case Command::Mask:
+        classes.push_back(-1);
+        break;
+    }
+
+    countGeometries(*piece++);
+  }
+
+  auto wd = QByteArray::number(size.width());
+  auto ht = QByteArray::number(size.height());
+
+  mOut += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\"";
+  mOut += " width=\"" + wd + "\" height=\"" + ht + "\" viewBox=\"0 0 " + wd + ' ' + ht + "\" xml:space=\"preserve\">\n";
+  writeStyles();
+  writeDefinitions();
+
+  mOut += "<g transform=\"translate(";
+  appendNumber(mOut, origin.x());
+  mOut += ' ';
+  appendNumber(mOut, origin.y());
+  mOut += ")\"";
+  writeFont(list.font());
+  mOut += ">\n";
+
+  QFontMetricsF fm{list.font()};
+  auto cls = classes.begin();
+  piece    = pieces.begin();
+
+  for (auto& cmd: list)
+  {
+    switch (cmd.kind)
+    {
+      case Command::Path:
+      case Command::Stamps:
+        writeShape(*cls, cmd.path, *piece);
+        break;
+
+      case Command::Mask:
+        writeImage(cmd.rect.topLeft(), filledImage(cmd.brush.color(), cmd.image));
+        break;
+
+      case Command::Text:
+        writeText(*cls, textPosition(fm, cmd.rect, cmd.flags), cmd.text);
+        break;
+    }
+
+    ++cls;
+    ++piece;
+    flush(false);
+  }
+
+  mOut += "</g>\n</svg>\n";
+  flush(true);
+  mDeflater.reset();
+}
+
+
+
+/// The index of the style class with the given \a declarations, which is
+/// added if it does not exist yet.
+int SvgWriter::styleClass(const QByteArray& declarations)
+{
+  auto i = mClasses.find(declarations);
+  if (i == mClasses.end())
+    i = mClasses.insert(declarations, mClasses.size());
+
+  return i.value();
+}
+
+
+
+/// Splits the \a path, which is drawn with \a pen and \a brush, into its
+/// subpaths. Subpaths that look the same when drawn on their own get a
+/// geometry: those that do not overlap others, and all of them if the path
+/// is only stroked with an opaque pen. Short subpaths do not get one.
+auto SvgWriter::shapePieces(const QPainterPath& path, const QPen& pen, const QBrush& brush) -> Pieces
+{
+  Pieces result;
+  std::vector<QRectF> bounds;
+
+  auto margin = (pen.style() == Qt::NoPen ? 1 : std::max(pen.widthF(), 1.0) + 2);
+  auto count  = path.elementCount();
+
+  for (int begin = 0; begin < count;)
+  {
+    int end = begin + 1;
+    while (end < count && !path.elementAt(end).isMoveTo())
+      ++end;
+
+    // A single move draws nothing
+    if (end - begin > 1)
+    {
+      QPointF min{path.elementAt(begin)};
+      QPointF max{min};
+
+      for (int i = begin + 1; i < end; ++i)
+      {
+        auto& e = path.elementAt(i);
+        min = QPointF{std::min(min.x(), e.x), std::min(min.y(), e.y)};
+        max = QPointF{std::max(max.x(), e.x), std::max(max.y(), e.y)};
+      }
+
+      result.push_back(Piece{begin, end, 0, 0, QByteArray{}});
+      bounds.push_back(QRectF{min, max}.adjusted(-margin, -margin, margin, margin));
+    }
+
+    begin = end;
+  }
+
+  std::vector<bool> overlaps(result.size(), false);
+  bool opaqueStroke = (brush.style() == Qt::NoBrush && (pen.style() == Qt::NoPen || pen.color().alpha() == 255));
+
+  if (!opaqueStroke)
+  {
+    // Sweep over the subpaths from left to right
+    std::vector<size_t> order(result.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+              { return bounds[a].left() < bounds[b].left(); });
+
+    for (auto a = order.begin(); a != order.end(); ++a)
+      for (auto b = a + 1; b != order.end() && bounds[*b].left() <= bounds[*a].right(); ++b)
+        if (bounds[*a].intersects(bounds[*b]))
+          overlaps[*a] = overlaps[*b] = true;
+  }
+
+  for (size_t i = 0; i < result.size(); ++i)
+    if (!overlaps[i])
+    {
+      auto& piece = result[i];
+      auto& first = path.elementAt(piece.begin);
+      appendPathData(piece.geometry, path, piece.begin, piece.end, -fixed(first.x), -fixed(first.y));
+
+      if (piece.geometry.size() < MinSharedBytes)
+        piece.geometry.clear();
+    }
+
+  return result;
+}
+
+
+
+/// One piece for each instance of the \a glyph at the \a positions.
+auto SvgWriter::stampPieces(const QPainterPath& glyph, const QVector<QPoint>& positions) -> Pieces
+{
+  if (glyph.isEmpty())
+    return Pieces{};
+
+  auto& first = glyph.elementAt(0);
+  auto  count = glyph.elementCount();
+
+  QByteArray geometry;
+  appendPathData(geometry, glyph, 0, count, -fixed(first.x), -fixed(first.y));
+
+  Pieces result;
+  result.reserve(static_cast<size_t>(positions.size()));
+
+  for (auto& pos: positions)
+    result.push_back(Piece{0, count, fixed(pos.x()), fixed(pos.y()), geometry});
+
+  return result;
+}
+
+
+
+/// Counts how often the geometries of the \a pieces are used.
+void SvgWriter::countGeometries(const Pieces& pieces)
+{
+  for (auto& piece: pieces)
+    if (!piece.geometry.isEmpty() && mUses[piece.geometry]++ == 0)
+      mGeometries.push_back(piece.geometry);
+}
+
+
+
+void SvgWriter::writeStyles()
+{
+  std::vector<QByteArray> styles(static_cast<size_t>(mClasses.size()));
+  for (auto i = mClasses.begin(); i != mClasses.end(); ++i)
+    styles[static_cast<size_t>(i.value())] = i.key();
+
+  mOut += "<style type=\"text/css\">\n";
+  for (size_t i = 0; i < styles.size(); ++i)
+    mOut += ".s" + QByteArray::number(static_cast<int>(i)) + '{' + styles[i] + "}\n";
+
+  mOut += "</style>\n";
+}
+
+
+
+/// Writes a definition for each geometry that is used more than once.
+void SvgWriter::writeDefinitions()
+{
+  mIds.clear();
+  for (auto& geometry: mGeometries)
+    if (mUses.value(geometry) > 1)
+      mIds.insert(geometry, mIds.size());
+
+  if (mIds.isEmpty())
+    return;
+
+  mOut += "<defs>\n";
+  for (auto& geometry: mGeometries)
+  {
+    auto id = mIds.find(geometry);
+    if (id != mIds.end())
+      mOut += "<path id=\"p" + QByteArray::number(id.value()) + "\" d=\"" + geometry + "\"/>\n";
+  }
+
+  mOut += "</defs>\n";
+}
+
+
+
+/// Writes the attributes for the \a font, which is inherited by all text.
+void SvgWriter::writeFont(const QFont& font)
+{
+  mOut += " font-family=\"" + font.family().toHtmlEscaped().toUtf8() + "\" font-size=\"";
+
+  if (font.pixelSize() > 0)
+    mOut += QByteArray::number(font.pixelSize());
+  else
+    appendNumber(mOut, font.pointSizeF());
+
+  mOut += '"';
+
+  if (font.weight() != QFont::Normal)
+    mOut += " font-weight=\"" + QByteArray::number(cssWeight(font.weight())) + '"';
+
+  if (font.style() != QFont::StyleNormal)
+    mOut += " font-style=\"italic\"";
+}
+
+
+
+/// Writes the \a pieces of \a path with the style class \a cls. Pieces with
+/// a definition reference it, all others are written as one path.
+void SvgWriter::writeShape(int cls, const QPainterPath& path, const Pieces& pieces)
+{
+  QByteArray data;
+  QByteArray uses;
+  int count = 0;
+
+  for (auto& piece: pieces)
+  {
+    auto id = mIds.find(piece.geometry);
+    if (id == mIds.end())
+    {
+      appendPathData(data, path, piece.begin, piece.end, piece.dx, piece.dy);
+      continue;
+    }
+
+    auto& first = path.elementAt(piece.begin);
+    uses += "<use xlink:href=\"#p" + QByteArray::number(id.value()) + "\" x=\"";
+    appendFixed(uses, fixed(first.x) + piece.dx);
+    uses += "\" y=\"";
+    appendFixed(uses, fixed(first.y) + piece.dy);
+    uses += "\"/>\n";
+    ++count;
+  }
+
+  auto attr = " class=\"s" + QByteArray::number(cls) + '"';
+
+  if (count == 0)
+  {
+    if (!data.isEmpty())
+      mOut += "<path" + attr + " d=\"" + data + "\"/>\n";
+  }
+  else if (count == 1 && data.isEmpty())
+    mOut += "<use" + attr + uses.mid(4);
+  else
+  {
+    mOut += "<g" + attr + ">\n";
+    if (!data.isEmpty())
+      mOut += "<path d=\"" + data + "\"/>\n";
+
+    mOut += uses + "</g>\n";
+  }
+}
+
+
+
+void SvgWriter::writeText(int cls, const QPointF& pos, const QString& text)
+{
+  mOut += "<text class=\"s" + QByteArray::number(cls) + "\" x=\"";
+  appendNumber(mOut, pos.x());
+  mOut += "\" y=\"";
+  appendNumber(mOut, pos.y());
+  mOut += "\">" + text.toHtmlEscaped().toUtf8() + "</text>\n";
+}
+
+
+
+/// Writes the \a image as embedded PNG file.
+void SvgWriter::writeImage(const QPoint& pos, const QImage& image)
+{
+  QByteArray png;
+  QBuffer buffer{&png};
+  buffer.open(QIODevice::WriteOnly);
+  PngWriter{}.write(buffer, image);
+
+  mOut += "<image x=\"" + QByteArray::number(pos.x()) + "\" y=\"" + QByteArray::number(pos.y())
+          + "\" width=\"" + QByteArray::number(image.width()) + "\" height=\"" + QByteArray::number(image.height())
+          + "\" xlink:href=\"data:image/png;base64," + png.toBase64() + "\"/>\n";
+}
+
+
+
+/// Writes the buffered output to the device, if there is enough of it or
+/// if it is the \a last part of the document.
+void SvgWriter::flush(bool last)
+{
+  if (mOut.size() < ChunkBytes && !last)
+    return;
+
+  if (mDeflater)
+    mOut = mDeflater->deflateChunk(mOut, last);
+
+  if (mDev.write(mOut) != mOut.size())
+    throw std::runtime_error{mDev.errorString().toStdString()};
+
+  mOut.clear();
+}
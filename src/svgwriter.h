@@ -0,0 +1,84 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "common.h"
+#include <memory>
+#include <vector>
+#include <QByteArray>
+#include <QHash>
+#include <QPointF>
+#include <QSize>
+#include <QVector>
+class DisplayList;
+class QBrush;
+class QFont;
+class QImage;
+class QIODevice;
+class QPainterPath;
+class QPen;
+
+
+
+/// Writes display lists as SVG documents. Unlike QSvgGenerator, it puts the
+/// pen and brush of the commands into a style sheet, and writes the paths
+/// with relative coordinates rounded to 1/100 pixel. Marks and subpaths
+/// that occur more than once are defined once and referenced by <use>
+/// elements. The document is streamed to the output device while it is
+/// generated, optionally compressed with gzip.
+///
+class SvgWriter
+{
+  public:
+    explicit SvgWriter(QIODevice& dev);
+    ~SvgWriter();
+
+    /// Enables gzip compression of the document, as used by .svgz files.
+    void setCompressed(bool enable) noexcept;
+
+    /// Writes the display \a list as SVG document of \a size pixels. The
+    /// \a origin is added to the coordinates of the commands, like the
+    /// painter transformation when replaying the list. Throws
+    /// std::runtime_error if writing fails.
+    void write(const DisplayList& list, const QSize& size, const QPointF& origin);
+
+  private:
+    struct Piece;
+    struct Deflater;
+    using Pieces = std::vector<Piece>;
+
+    int styleClass(const QByteArray& declarations);
+    static Pieces shapePieces(const QPainterPath& path, const QPen& pen, const QBrush& brush);
+    static Pieces stampPieces(const QPainterPath& glyph, const QVector<QPoint>& positions);
+    void countGeometries(const Pieces& pieces);
+    void writeStyles();
+    void writeDefinitions();
+    void writeFont(const QFont& font);
+    void writeShape(int cls, const QPainterPath& path, const Pieces& pieces);
+    void writeText(int cls, const QPointF& pos, const QString& text);
+    void writeImage(const QPoint& pos, const QImage& image);
+    void flush(bool last);
+
+    QIODevice& mDev;
+    QByteArray mOut;
+    std::unique_ptr<Deflater> mDeflater;
+    bool mCompressed;
+    QHash<QByteArray, int> mClasses;
+    QHash<QByteArray, int> mUses;
+    QHash<QByteArray, int> mIds;
+    std::vector<QByteArray> mGeometries;
+};
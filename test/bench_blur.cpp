@@ -0,0 +1,91 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "blur.h"
+#include "reference_blur.h"
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <QElapsedTimer>
+#include <QPainter>
+
+
+
+/// A shadow mask like Render produces it: a grid of filled boxes.
+QImage shadowMask(int width, int height)
+{
+  QImage mask{width, height, QImage::Format_Alpha8};
+  mask.fill(Qt::transparent);
+
+  QPainter painter{&mask};
+  painter.setPen(Qt::NoPen);
+  painter.setBrush(Qt::black);
+
+  for (int y = 8; y + 40 < height; y += 64)
+    for (int x = 8; x + 100 < width; x += 160)
+      painter.drawRect(x, y, 100 + (x + y) % 40, 40);
+
+  return mask;
+}
+
+
+
+bool equal(const QImage& a, const QImage& b)
+{
+  for (int y = 0; y < a.height(); ++y)
+    if (memcmp(a.constScanLine(y), b.constScanLine(y), static_cast<size_t>(a.width())) != 0)
+      return false;
+
+  return true;
+}
+
+
+
+int main()
+{
+  const int height = 1024;
+  const int radius = 2;
+  bool ok = true;
+
+  std::cout << "   width   reference   optimized   speedup\n";
+
+  for (int width: {4096, 8192, 12288, 16384})
+  {
+    auto refImg = shadowMask(width, height);
+    auto optImg = refImg.copy();
+
+    QElapsedTimer timer;
+    timer.start();
+    reference::blurImage(refImg, radius);
+    auto refNs = timer.nsecsElapsed();
+
+    timer.start();
+    blurImage(optImg, radius);
+    auto optNs = timer.nsecsElapsed();
+
+    bool same = equal(refImg, optImg);
+    ok &= same;
+
+    std::cout << std::setw(8) << width
+              << std::setw(10) << std::fixed << std::setprecision(1) << refNs * 1e-6 << "ms"
+              << std::setw(10) << optNs * 1e-6 << "ms"
+              << std::setw(9)  << std::setprecision(2) << static_cast<double>(refNs) / optNs << "x"
+              << (same ? "" : "   MISMATCH") << '\n';
+  }
+
+  return ok ? 0 : 1;
+}
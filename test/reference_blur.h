@@ -0,0 +1,33 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <QImage>
+
+
+
+// The shadow blur as it was before it got optimized for speed. The optimized
+// versions must produce exactly the same result.
+//
+namespace reference {
+
+/// Convolutes the Alpha8 image \a img with a Gaussian blur of radius \a r,
+/// dividing the sums of the box filters by their diameter. The image must be
+/// wider and higher than the diameter of the boxes.
+void blurImage(QImage& img, int r);
+
+} // namespace reference
@@ -0,0 +1,142 @@
+/*  Copyright 2020 Uwe Salomon <post@uwesalomon.de>
+
+    This file is part of Drawscii.
+
+    Drawscii is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Drawscii is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Drawscii.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "test_blur.h"
+#include "blur.h"
+#include "reference_blur.h"
+#include <random>
+QTEST_MAIN(TestBlur)
+
+
+
+namespace {
+const char* const KernelNames[] = {"scalar", "sse2", "avx2"};
+
+
+
+/// A shadow mask with saturated, empty and noisy areas. The sizes are no
+/// multiples of the vector and strip widths, so that the tails of the rows
+/// are blurred as well.
+QImage testMask(int width, int height)
+{
+  QImage mask{width, height, QImage::Format_Alpha8};
+  std::minstd_rand random{4711};
+
+  for (int y = 0; y < height; ++y)
+  {
+    auto line = mask.scanLine(y);
+    for (int x = 0; x < width; ++x)
+    {
+      auto value = random() % 256;
+      if (x < width / 3)
+        line[x] = (value < 8 ? 254 : 255);
+      else if (x < 2 * width / 3)
+        line[x] = static_cast<uchar>(value);
+      else
+        line[x] = (value < 8 ? 1 : 0);
+    }
+  }
+
+  return mask;
+}
+
+
+
+/// Describes the first pixel where \a actual differs from \a expected.
+QString firstDifference(const QImage& actual, const QImage& expected)
+{
+  for (int y = 0; y < actual.height(); ++y)
+  {
+    auto a = actual.constScanLine(y);
+    auto e = expected.constScanLine(y);
+
+    for (int x = 0; x < actual.width(); ++x)
+      if (a[x] != e[x])
+        return QString{"pixel (%1, %2) is %3 instead of %4"}.arg(x).arg(y).arg(a[x]).arg(e[x]);
+  }
+
+  return QString{};
+}
+} // namespace
+
+
+
+void TestBlur::kernels_data()
+{
+  QTest::addColumn<int>("kernel");
+  QTest::addColumn<int>("radius");
+  QTest::addColumn<int>("parts");
+
+  // The image is small enough for one partition, unless they are forced. Its
+  // 7 bands of rows and 5 cache lines of columns do not divide evenly.
+  for (int kernel = 0; kernel < 3; ++kernel)
+    for (int radius = 1; radius <= 25; ++radius)
+      for (int parts: {0, 3, 8})
+        QTest::newRow(qPrintable(QString{"%1 r=%2 parts=%3"}.arg(KernelNames[kernel]).arg(radius).arg(parts)))
+            << kernel << radius << parts;
+}
+
+
+
+void TestBlur::kernels()
+{
+  QFETCH(int, kernel);
+  QFETCH(int, radius);
+  QFETCH(int, parts);
+
+  if (!isSupported(static_cast<BlurKernel>(kernel)))
+    QSKIP("kernel not supported by this CPU");
+
+  auto img      = testMask(301, 203);
+  auto expected = img.copy();
+  reference::blurImage(expected, radius);
+  blurImage(img, radius, static_cast<BlurKernel>(kernel), parts);
+  QVERIFY2(img == expected, qPrintable(firstDifference(img, expected)));
+}
+
+
+
+void TestBlur::reciprocalLimit_data()
+{
+  QTest::addColumn<int>("kernel");
+  QTest::addColumn<int>("radius");
+
+  // The box diameters for these radii are 4095 for all boxes, 4095 and 4099,
+  // and 4099 for all boxes: on both sides of the largest diameter for which
+  // the kernels multiply with the reciprocal instead of dividing
+  for (int kernel = 0; kernel < 3; ++kernel)
+    for (int radius: {2630, 2631, 2633})
+      QTest::newRow(qPrintable(QString{"%1 r=%2"}.arg(KernelNames[kernel]).arg(radius))) << kernel << radius;
+}
+
+
+
+void TestBlur::reciprocalLimit()
+{
+  QFETCH(int, kernel);
+  QFETCH(int, radius);
+
+  if (!isSupported(static_cast<BlurKernel>(kernel)))
+    QSKIP("kernel not supported by this CPU");
+
+  // The reference blur needs an image larger than the boxes
+  auto img      = testMask(4133, 4127);
+  auto expected = img.copy();
+  reference::blurImage(expected, radius);
+  blurImage(img, radius, static_cast<BlurKernel>(kernel));
+  QVERIFY2(img == expected, qPrintable(firstDifference(img, expected)));
+}
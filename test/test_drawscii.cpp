@@ -18,9 +18,12 @@
 #include "test_drawscii.h"
 #include "tempfile.h"
 #include <stdexcept>
+#include <QFile>
+#include <QFileInfo>
 #include <QFont>
 #include <QImage>
 #include <QProcess>
+#include <zlib.h>
 QTEST_MAIN(TestDrawscii)
 
 
@@ -45,6 +48,9 @@ void TestDrawscii::verifyImageOutput_data()
 
   QTest::newRow("arrow_vs_text.png")   << "arrow_vs_text"   << "png" << "";
   QTest::newRow("can.png")             << "can"             << "png" << "";
+  QTest::newRow("can.png fast")        << "can"             << "png" << "--png-compression fast --png-filter paeth";
+  QTest::newRow("can.png max")         << "can"             << "png" << "--png-compression max";
+  QTest::newRow("can.ppm")             << "can"             << "ppm" << "";
   QTest::newRow("color_codes.png")     << "color_codes"     << "png" << "";
   QTest::newRow("color_more.png")      << "color_more"      << "png" << "--no-shadows";
   QTest::newRow("corner.png")          << "corner"          << "png" << "";
@@ -53,10 +59,13 @@ void TestDrawscii::verifyImageOutput_data()
   QTest::newRow("dashed_lines.svg")    << "dashed_lines"    << "svg" << "";
   QTest::newRow("diag_tree.bmp")       << "diag_tree"       << "bmp" << "";
   QTest::newRow("hell.png")            << "hell"            << "png" << "--font-size 20";
+  QTest::newRow("hell.png 1 thread")   << "hell"            << "png" << "--font-size 20 --threads 1";
   QTest::newRow("hell.svg")            << "hell"            << "svg" << "--font-size 20";
+  QTest::newRow("hell.svgz")           << "hell"            << "svgz" << "--font-size 20";
   QTest::newRow("intertwined.png")     << "intertwined"     << "png" << "";
   QTest::newRow("leapfrog.png")        << "leapfrog"        << "png" << "";
   QTest::newRow("letters.png")         << "letters"         << "png" << "--background transparent";
+  QTest::newRow("letters.png max")     << "letters"         << "png" << "--background transparent --png-compression max";
   QTest::newRow("linked_shapes.png")   << "linked_shapes"   << "png" << "";
   QTest::newRow("parallelogram.png")   << "parallelogram"   << "png" << "--background darkgray";
   QTest::newRow("rect_intersect.svg")  << "rect_intersect"  << "svg" << "--shadows";
@@ -85,16 +94,277 @@ try
 
   auto input  = QFINDTESTDATA("input/" + fbasename + ".txt");
   auto output = mTmpDir + "/" + fbasename + "." + suffix;
-  auto truth  = QFINDTESTDATA("output/" + fbasename + "." + suffix);
+  auto truth  = QFINDTESTDATA("output/" + fbasename + "." + (suffix == "svgz" ? "svg" : suffix));
 
   QVERIFY(runDrawscii(args.split(' ', QString::SkipEmptyParts) << "-o" << output << input, 0));
-  checkImagesEqual(output, truth);
+  if (suffix == "svgz")
+    checkCompressedSvg(output, truth);
+  else
+    checkImagesEqual(output, truth);
+}
+catch (const std::exception& e)
+{ QFAIL(e.what()); }
+
+
+
+void TestDrawscii::multipleOutputs()
+try
+{
+  QStringList args{"--font-size", "20", QFINDTESTDATA("input/hell.txt")};
+  for (auto suffix: {"png", "svg", "svgz"})
+    args << "-o" << mTmpDir + "/hell_multi." + suffix;
+
+  QVERIFY(runDrawscii(args, 0));
+  for (auto suffix: {"png", "svg"})
+    checkImagesEqual(mTmpDir + "/hell_multi." + suffix, QFINDTESTDATA(QString{"output/hell."} + suffix));
+
+  checkCompressedSvg(mTmpDir + "/hell_multi.svgz", QFINDTESTDATA("output/hell.svg"));
+}
+catch (const std::exception& e)
+{ QFAIL(e.what()); }
+
+
+
+void TestDrawscii::multipleScales()
+try
+{
+  QVERIFY(runDrawscii({"--scales", "1,2", "-o", mTmpDir + "/can@%sx.png", QFINDTESTDATA("input/can.txt")}, 0));
+  checkImagesEqual(mTmpDir + "/can@1x.png", QFINDTESTDATA("output/can.png"));
+
+  QImage small{mTmpDir + "/can@1x.png"};
+  QImage large{mTmpDir + "/can@2x.png"};
+  QVERIFY(!large.isNull());
+  QVERIFY(qAbs(large.width() - 2 * small.width()) <= 4);
+  QVERIFY(qAbs(large.height() - 2 * small.height()) <= 4);
+}
+catch (const std::exception& e)
+{ QFAIL(e.what()); }
+
+
+
+void TestDrawscii::multiPagePdf()
+{
+  TempFile tmp{"pdf"};
+  QVERIFY(runDrawscii({"-o", tmp.fileName(), QFINDTESTDATA("input/can.txt"), QFINDTESTDATA("input/hell.txt")}, 0));
+
+  QFile fd{tmp.fileName()};
+  QVERIFY(fd.open(QFile::ReadOnly));
+
+  auto pdf = fd.readAll();
+  QVERIFY(pdf.contains("/Count 2"));
+  QCOMPARE(pdf.count("/MediaBox"), 2);
+  QCOMPARE(pdf.count("/FontFile"), 1);
+}
+
+
+
+void TestDrawscii::batchMode()
+try
+{
+  QVERIFY(runDrawscii({"-o", mTmpDir + "/batch_%n.png", QFINDTESTDATA("input/can.txt"), QFINDTESTDATA("input/corner.txt")}, 0));
+  checkImagesEqual(mTmpDir + "/batch_can.png", QFINDTESTDATA("output/can.png"));
+  checkImagesEqual(mTmpDir + "/batch_corner.png", QFINDTESTDATA("output/corner.png"));
+
+  // A missing input file is reported, but the others are still processed
+  TempFile manifest{"txt"};
+  QVERIFY(manifest.open());
+  manifest.write("# drawings\n\n");
+  manifest.write(QFINDTESTDATA("input/leapfrog.txt").toUtf8() + "\ndoes/not/exist.txt\n");
+  manifest.close();
+
+  QVERIFY(runDrawscii({"--manifest", manifest.fileName(), "-o", mTmpDir + "/batch_%n.png"}, 1));
+  QVERIFY(mStderr.contains("exist.txt"));
+
+  // Several input files must not write the same output file
+  QVERIFY(runDrawscii({"-o", mTmpDir + "/batch_%n.png", QFINDTESTDATA("input/can.txt"), QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+  checkImagesEqual(mTmpDir + "/batch_leapfrog.png", QFINDTESTDATA("output/leapfrog.png"));
+}
+catch (const std::exception& e)
+{ QFAIL(e.what()); }
+
+
+
+void TestDrawscii::grayscale()
+try
+{
+  // Colorless drawings are written as gray PNG files without being asked to
+  auto output = mTmpDir + "/can_gray.png";
+  QVERIFY(runDrawscii({"-o", output, QFINDTESTDATA("input/can.txt")}, 0));
+  QCOMPARE(QImage{output}.format(), QImage::Format_Grayscale8);
+  checkImagesEqual(output, QFINDTESTDATA("output/can.png"));
+
+  // Colored ones stay in color, also with --grayscale
+  output = mTmpDir + "/color_codes_gray.png";
+  QVERIFY(runDrawscii({"--grayscale", "-o", output, QFINDTESTDATA("input/color_codes.txt")}, 0));
+  QCOMPARE(QImage{output}.format(), QImage::Format_RGB32);
+  checkImagesEqual(output, QFINDTESTDATA("output/color_codes.png"));
+
+  // As do colorless drawings on a colored background
+  output = mTmpDir + "/can_colored_bg.png";
+  QVERIFY(runDrawscii({"--background", "lightblue", "-o", output, QFINDTESTDATA("input/can.txt")}, 0));
+  QCOMPARE(QImage{output}.format(), QImage::Format_RGB32);
+}
+catch (const std::exception& e)
+{ QFAIL(e.what()); }
+
+
+
+void TestDrawscii::rawLayout()
+{
+  // The pixel layout of raw files depends on the options only, not on the
+  // colors in the drawing
+  for (auto fbasename: {"can", "color_codes"})
+  {
+    QImage truth{QFINDTESTDATA(QString{"output/"} + fbasename + ".png")};
+    QVERIFY(!truth.isNull());
+
+    auto pixels = static_cast<qint64>(truth.width()) * truth.height();
+    auto input  = QFINDTESTDATA(QString{"input/"} + fbasename + ".txt");
+    TempFile raw{"raw"};
+
+    QVERIFY(runDrawscii({"-o", raw.fileName(), input}, 0));
+    QCOMPARE(QFileInfo{raw.fileName()}.size(), 4 * pixels);
+
+    QVERIFY(runDrawscii({"--grayscale", "-o", raw.fileName(), input}, 0));
+    QCOMPARE(QFileInfo{raw.fileName()}.size(), pixels);
+  }
+
+  TempFile raw{"raw"};
+  QVERIFY(runDrawscii({"--grayscale", "--background", "transparent", "-o", raw.fileName(), QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+}
+
+
+
+void TestDrawscii::tiledOutput()
+{
+  // A drawing of several million pixels, with lines and shapes crossing the
+  // tiles, and lines running through all of them
+  static const char* const cell[] = {
+    "+-------+          +--+ ",
+    "| text  |--------->|  | ",
+    "|  cRED |    ---   +--+ ",
+    "+-------+  ======       ",
+    "    o-----*-----+       ",
+  };
+
+  TempFile input{"txt"};
+  QVERIFY(input.open());
+  for (int row = 0; row < 120; ++row)
+  {
+    QByteArray line{"|"};
+    for (int col = 0; col < 8; ++col)
+      line += cell[row % 5];
+
+    input.write(line + " :\n");
+  }
+  input.close();
+
+  // A single thread paints the bitmap in one tile, several threads split it
+  auto single = mTmpDir + "/tiled_single.png";
+  auto tiled  = mTmpDir + "/tiled.png";
+  QVERIFY(runDrawscii({"--threads", "1", "-o", single, input.fileName()}, 0));
+  QVERIFY(runDrawscii({"--threads", "4", "-o", tiled, input.fileName()}, 0));
+
+  QImage singleImg{single};
+  QImage tiledImg{tiled};
+  QVERIFY(singleImg.width() * singleImg.height() >= 1024 * 1024);
+  QCOMPARE(tiledImg.size(), singleImg.size());
+  QCOMPARE(tiledImg.format(), singleImg.format());
+
+  // Seams would show as rows with missing or doubled strokes, which a mean
+  // difference over the whole image hides
+  for (int y = 0; y < singleImg.height(); ++y)
+    for (int x = 0; x < singleImg.width(); ++x)
+    {
+      auto s = singleImg.pixel(x, y);
+      auto t = tiledImg.pixel(x, y);
+      if (qAbs(qRed(s) - qRed(t)) > 8 || qAbs(qGreen(s) - qGreen(t)) > 8 || qAbs(qBlue(s) - qBlue(t)) > 8)
+        QFAIL(qPrintable(QString{"tiled image differs at %1,%2"}.arg(x).arg(y)));
+    }
+}
+
+
+
+void TestDrawscii::shadowCache()
+try
+{
+  // The two boxes on the left cast identical shadows, so the second one
+  // takes the mask of the first
+  auto output = mTmpDir + "/square_shade_cached.png";
+  QVERIFY(runDrawscii({"-o", output, QFINDTESTDATA("input/square_shade.txt")}, 0));
+  checkImagesEqual(output, QFINDTESTDATA("output/square_shade.png"));
+
+  // With one thread, the second copy of the drawing takes all its masks from
+  // the cache
+  QStringList args{"--threads", "1", "-o", mTmpDir + "/%n.png"};
+  for (auto copy: {"cache_a", "cache_b"})
+  {
+    auto input = mTmpDir + "/" + copy + ".txt";
+    QFile::remove(input);
+    QVERIFY(QFile::copy(QFINDTESTDATA("input/square_shade.txt"), input));
+    args << input;
+  }
+
+  QVERIFY(runDrawscii(args, 0));
+  checkImagesEqual(mTmpDir + "/cache_a.png", QFINDTESTDATA("output/square_shade.png"));
+  checkImagesEqual(mTmpDir + "/cache_b.png", QFINDTESTDATA("output/square_shade.png"));
 }
 catch (const std::exception& e)
 { QFAIL(e.what()); }
 
 
 
+void TestDrawscii::shadowMargins_data()
+{
+  QTest::addColumn<QString>("args");
+  QTest::addColumn<QString>("scale");
+
+  QTest::newRow("large")           << "--shadow-size 12"                            << "1";
+  QTest::newRow("large recursive") << "--shadow-size 12 --shadow-filter recursive" << "1";
+  QTest::newRow("recursive")       << "--shadow-size 6 --shadow-filter recursive"  << "1";
+  QTest::newRow("default scaled")  << "--scales 1,4 --shadows"                      << "4";
+}
+
+
+
+void TestDrawscii::shadowMargins()
+{
+  QFETCH(QString, args);
+  QFETCH(QString, scale);
+
+  auto output = mTmpDir + "/can_shadow@%sx.png";
+  QVERIFY(runDrawscii(args.split(' ', QString::SkipEmptyParts) << "-o" << output << QFINDTESTDATA("input/can.txt"), 0));
+
+  // The drawing is enlarged for the shadow of the box in its bottom right
+  // corner, which must not be cut off anywhere; default shadows only keep
+  // the usual margin at scale 1
+  QImage img{QString{output}.replace("%s", scale)};
+  QImage standard{QFINDTESTDATA("output/can.png")};
+  QVERIFY(!img.isNull());
+  QVERIFY(img.width() > standard.width());
+  QVERIFY(img.height() > standard.height());
+
+  auto white  = qRgb(255, 255, 255);
+  auto right  = img.width() - 1;
+  auto bottom = img.height() - 1;
+
+  for (int x = 0; x <= right; ++x)
+  {
+    QCOMPARE(img.pixel(x, 0), white);
+    QCOMPARE(img.pixel(x, bottom), white);
+  }
+
+  for (int y = 0; y <= bottom; ++y)
+  {
+    QCOMPARE(img.pixel(0, y), white);
+    QCOMPARE(img.pixel(right, y), white);
+  }
+}
+
+
+
 void TestDrawscii::errors()
 {
   QVERIFY(runDrawscii({}, 1));
@@ -107,6 +377,22 @@ void TestDrawscii::errors()
   QVERIFY(runDrawscii({tmp.fileName(), QFINDTESTDATA("input/can.txt")}, 1));
   QVERIFY(mStderr.contains("error:"));
 
+  QVERIFY(runDrawscii({"-o", tmp.fileName(), QFINDTESTDATA("input/can.txt"), QFINDTESTDATA("input/hell.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+
+  TempFile ppm{"ppm"};
+  QVERIFY(runDrawscii({"--background", "transparent", "-o", ppm.fileName(), QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+
+  QVERIFY(runDrawscii({"--format", "png", "-o", tmp.fileName(), "-o", ppm.fileName(), QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+
+  QVERIFY(runDrawscii({"--scales", "1,2", "-o", tmp.fileName(), QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+
+  QVERIFY(runDrawscii({"-o", "-", QFINDTESTDATA("input/can.txt")}, 1));
+  QVERIFY(mStderr.contains("error:"));
+
   QVERIFY(runDrawscii({"-o", tmp.fileName(), "does/not/exist.txt"}, 1));
   QVERIFY(mStderr.contains("error:"));
   QVERIFY(mStderr.contains("does/not/exist.txt"));
@@ -154,6 +440,37 @@ inline unsigned sqrDiff(int a, int b)
   auto d = a - b;
   return static_cast<unsigned>(d * d);
 }
+
+
+
+/// The contents of the gzip file \a data.
+QByteArray gunzip(const QByteArray& data)
+{
+  z_stream zs{};
+  if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK)
+    throw std::runtime_error{"inflateInit2() failed"};
+
+  zs.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs.avail_in = static_cast<uInt>(data.size());
+
+  QByteArray result;
+  char buffer[16384];
+  int ret;
+
+  do
+  {
+    zs.next_out  = reinterpret_cast<Bytef*>(buffer);
+    zs.avail_out = sizeof(buffer);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    result.append(buffer, static_cast<int>(sizeof(buffer) - zs.avail_out));
+  } while (ret == Z_OK);
+
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END || zs.avail_in != 0)
+    throw std::runtime_error{"not a single valid gzip stream"};
+
+  return result;
+}
 } // namespace
 
 
@@ -188,3 +505,31 @@ void TestDrawscii::checkImagesEqual(const QString& output, const QString& truth)
   if (delta > 0.1)
     QWARN(qPrintable("images are not identical: TSS/N = " + QString::number(delta)));
 }
+
+
+
+/// Checks that \a output is a gzip file, and that the SVG file in it looks
+/// the same as the uncompressed SVG file \a truth. QImage would also load an
+/// uncompressed SVG file with a .svgz name.
+void TestDrawscii::checkCompressedSvg(const QString& output, const QString& truth)
+{
+  QFile fd{output};
+  QVERIFY(fd.open(QIODevice::ReadOnly));
+  auto data = fd.readAll();
+
+  QVERIFY(data.size() > 2);
+  QCOMPARE(static_cast<uchar>(data[0]), uchar{0x1f});
+  QCOMPARE(static_cast<uchar>(data[1]), uchar{0x8b});
+
+  auto svg = gunzip(data);
+  QVERIFY(svg.startsWith("<?xml"));
+  QVERIFY(svg.contains("<svg "));
+  QVERIFY(svg.trimmed().endsWith("</svg>"));
+
+  QFile unzipped{output + ".svg"};
+  QVERIFY(unzipped.open(QIODevice::WriteOnly | QIODevice::Truncate));
+  QCOMPARE(unzipped.write(svg), static_cast<qint64>(svg.size()));
+  unzipped.close();
+
+  checkImagesEqual(unzipped.fileName(), truth);
+}
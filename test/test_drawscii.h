@@ -28,11 +28,22 @@ class TestDrawscii : public QObject
     void initTestCase();
     void verifyImageOutput_data();
     void verifyImageOutput();
+    void multipleOutputs();
+    void multipleScales();
+    void multiPagePdf();
+    void batchMode();
+    void grayscale();
+    void rawLayout();
+    void tiledOutput();
+    void shadowCache();
+    void shadowMargins_data();
+    void shadowMargins();
     void errors();
 
   private:
     bool runDrawscii(const QStringList& args, int expectedExitCode);
     void checkImagesEqual(const QString& output, const QString& truth);
+    void checkCompressedSvg(const QString& output, const QString& truth);
 
     QString mTmpDir;
     QByteArray mStderr;